@@ -0,0 +1,37 @@
+#ifndef JOS_INC_CHAN_H
+#define JOS_INC_CHAN_H
+
+#include <inc/types.h>
+#include <inc/mmu.h>
+
+// A channel: a single-producer, single-consumer ring of messages in
+// memory shared by two environments (see sys_chan_create).  A header
+// page holding the indices is followed by ch_size bytes of ring.
+//
+// Each message is a 32-bit length and then the message bytes, padded
+// to a multiple of 4 bytes; a message may wrap around the end of the
+// ring.  ch_head and ch_tail count bytes produced and consumed, and
+// only ever increase (modulo 2^32).  Each side writes only its own
+// cache line of the header.
+//
+// A side that finds the ring empty or full sets its wait flag and
+// sleeps on the other side's index with sys_futex_wait; the other side
+// calls sys_futex_wake after moving that index if the flag is set.
+// The library routines are in lib/chan.c.
+#define CHAN_MAXPAGES	64	// Ring pages in a channel
+
+struct ChanHdr {
+	// Written by the producer
+	volatile uint32_t ch_head;	// Bytes produced
+	volatile uint32_t ch_wwait;	// Producer is asleep on ch_tail
+	uint8_t ch_pad0[CACHELINE - 8];
+
+	// Written by the consumer
+	volatile uint32_t ch_tail;	// Bytes consumed
+	volatile uint32_t ch_rwait;	// Consumer is asleep on ch_head
+	uint8_t ch_pad1[CACHELINE - 8];
+
+	uint32_t ch_size;		// Ring bytes; a power of two
+};
+
+#endif	// !JOS_INC_CHAN_H
@@ -11,28 +11,30 @@ typedef int32_t envid_t;
 
 // An environment ID 'envid_t' has three parts:
 //
-// +1+---------------21-----------------+--------10--------+
-// |0|          Uniqueifier             |   Environment    |
-// | |                                  |      Index       |
-// +------------------------------------+------------------+
-//                                       \--- ENVX(eid) --/
+// +1+-------------16--------------+-------------15-------------+
+// |0|          Uniqueifier          |         Environment         |
+// | |                               |            Index            |
+// +---------------------------------+-----------------------------+
+//                                    \-------- ENVX(eid) --------/
 //
 // The environment index ENVX(eid) equals the environment's index in the
-// 'envs[]' array.  The uniqueifier distinguishes environments that were
-// created at different times, but share the same environment index.
+// 'envs[]' array.  The kernel maps envs[] a page at a time as more
+// environments are needed, up to NENV.  The uniqueifier distinguishes
+// environments that were created at different times, but share the
+// same environment index.
 //
 // All real environments are greater than 0 (so the sign bit is zero).
 // envid_ts less than 0 signify errors.  The envid_t == 0 is special, and
 // stands for the current environment.
 
-#define LOG2NENV		10
+#define LOG2NENV		15
 #define NENV			(1 << LOG2NENV)
 #define ENVX(envid)		((envid) & (NENV - 1))
 
 // Values of env_status in struct Env
 enum {
 	ENV_FREE = 0,
-	ENV_DYING,
+	ENV_DYING,		// Destroyed; memory not yet reclaimed
 	ENV_RUNNABLE,
 	ENV_RUNNING,
 	ENV_NOT_RUNNABLE
@@ -41,8 +43,49 @@ enum {
 // Special environment types
 enum EnvType {
 	ENV_TYPE_USER = 0,
+	ENV_TYPE_KTHREAD,	// Kernel thread (see kern/kthread.c)
+	ENV_TYPE_TEMPLATE,	// Never runs; env_clone() copies it
 };
 
+// Per-env accounting, kept by trap() and env_run() and readable by
+// user programs through envs[].  Traps are counted in ENV_NTRAPSTAT
+// buckets: one per processor exception, one per IRQ, one for system
+// calls and one for anything else.
+#define ENV_NTRAPSTAT		38
+#define ENV_TRAPSTAT(trapno)						\
+	((trapno) <= T_SIMDERR ? (trapno) :				\
+	 (trapno) >= IRQ_OFFSET && (trapno) < IRQ_OFFSET + 16 ?	\
+		(trapno) - IRQ_OFFSET + T_SIMDERR + 1 :			\
+	 (trapno) == T_SYSCALL ? ENV_NTRAPSTAT - 2 : ENV_NTRAPSTAT - 1)
+#define ENV_NSYSCALLSTAT	36	// Syscall numbers counted singly;
+					// fills struct Env to 512 bytes
+
+// Time spent waiting on a run queue, in log2 buckets of TSC cycles:
+// bucket 0 counts waits under 2^(ENV_WAITHIST_MIN+1) cycles, bucket i
+// waits in [2^(ENV_WAITHIST_MIN+i), 2^(ENV_WAITHIST_MIN+i+1)), and the
+// last bucket everything longer.
+#define ENV_NWAITHIST		16
+#define ENV_WAITHIST_MIN	10
+
+struct EnvStats {
+	uint64_t es_utime;		// TSC cycles in user mode
+	uint64_t es_stime;		// TSC cycles in the kernel
+	uint32_t es_pgfaults;		// Page faults, including the kernel's
+					// on this env's behalf
+	uint32_t es_traps[ENV_NTRAPSTAT];
+	uint32_t es_syscalls[ENV_NSYSCALLSTAT];
+	uint32_t es_wait[ENV_NWAITHIST];	// Run queue waits
+};
+
+// struct Env is what user code sees at UENVS, so its layout is ABI:
+// the fields JOS has always had keep their original offsets, and new
+// user-visible fields only ever go in at fixed offsets after them (see
+// the asserts in env_init).  Entries are cache-line aligned, so no two
+// envs share a line.  The fields the scheduler and env_run() touch on
+// every switch, and that scans of envs[] read, fill the second line,
+// right after the trapframe env_run() pops anyway.  Kernel-only state
+// that is not needed on a switch lives in struct EnvCold, outside the
+// user-visible table (see kern/env.h).
 struct Env {
 	struct Trapframe env_tf;	// Saved registers
 	struct Env *env_link;		// Next free Env
@@ -54,6 +97,20 @@ struct Env {
 
 	// Address space
 	pde_t *env_pgdir;		// Kernel virtual address of page dir
-};
+
+	// Hot: scheduling
+	int8_t env_cpunum;		// CPU the env last ran on (affinity hint)
+	int8_t env_rq;			// Run queue holding this env, or -1
+	uint8_t env_rgroup;		// Resource group (see kern/rgroup.c)
+	uint8_t env_rt;			// Real-time slot + 1, or 0 (sched.c)
+	struct Env *env_rq_next;	// Run queue links
+	struct Env *env_rq_prev;
+	uint32_t env_kesp;		// Saved kernel stack pointer (kthreads)
+	struct VData *env_vdata;	// Kernel address of the UVDATA page
+	uint32_t env_tid;		// Thread number within env_pgdir
+	uint64_t env_queued;		// TSC when it last became runnable
+
+	struct EnvStats env_stats;	// Time and trap accounting
+} __attribute__((aligned(CACHELINE)));
 
 #endif // !JOS_INC_ENV_H
@@ -13,6 +13,12 @@ enum {
 	E_NO_FREE_ENV	,	// Attempt to create a new environment beyond
 				// the maximum allowed
 	E_FAULT		,	// Memory fault
+	E_OVERLOAD	,	// Admitting this would overload the CPU
+	E_IPC_NOT_RECV	,	// Attempt to send to env that is not recving
+	E_AGAIN		,	// Value changed; try again
+	E_TIMEOUT	,	// Wait timed out
+	E_NOT_FOUND	,	// No object by that name or handle
+	E_EXISTS	,	// An object by that name already exists
 
 	MAXERROR
 };
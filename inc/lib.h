@@ -16,6 +16,9 @@
 #include <inc/env.h>
 #include <inc/memlayout.h>
 #include <inc/syscall.h>
+#include <inc/uring.h>
+#include <inc/chan.h>
+#include <inc/shm.h>
 
 #define USED(x)		(void)(x)
 
@@ -28,18 +31,148 @@ extern const volatile struct Env *thisenv;
 extern const volatile struct Env envs[NENV];
 extern const volatile struct PageInfo pages[];
 
+// batch.c
+struct SyscallBatch {
+	struct SyscallDesc sb_desc[SYS_BATCH_MAX];
+	int sb_n;			// Entries queued
+};
+
+void	batch_init(struct SyscallBatch *b);
+int	batch_add(struct SyscallBatch *b, uint32_t num, uint32_t a1,
+		  uint32_t a2, uint32_t a3, uint32_t a4, uint32_t a5);
+int	batch_page_alloc(struct SyscallBatch *b, envid_t envid, void *va,
+			 int perm);
+int	batch_page_map(struct SyscallBatch *b, envid_t srcenv, void *srcva,
+		       envid_t dstenv, void *dstva, int perm);
+int	batch_page_unmap(struct SyscallBatch *b, envid_t envid, void *va);
+int	batch_env_set_status(struct SyscallBatch *b, envid_t envid,
+			     int status);
+int	batch_run(struct SyscallBatch *b);
+
+// chan.c
+struct Chan {
+	struct ChanHdr *c_hdr;
+	uint8_t *c_ring;
+	uint32_t c_mask;		// ch_size - 1
+};
+
+int	chan_create(struct Chan *c, envid_t peer, void *va, void *peerva,
+		    uint32_t npages);
+void	chan_attach(struct Chan *c, void *va);
+int	chan_send(struct Chan *c, const void *buf, size_t len);
+int	chan_recv(struct Chan *c, void *buf, size_t len);
+
 // exit.c
 void	exit(void);
 
+// fork.c
+envid_t	fork(void);
+
+// ipc.c
+int32_t	ipc_recv(envid_t *from_env_store, void *pg, int *perm_store);
+void	ipc_send(envid_t to_env, uint32_t value, void *pg, int perm);
+int32_t	ipc_call(envid_t to_env, uint32_t value, void *pg, int perm,
+		 envid_t *from_env_store, int *perm_store);
+
+// sync.c
+struct Mutex {
+	volatile uint32_t m_state;	// 0 free, 1 held, 2 held with waiters
+};
+
+struct Cond {
+	volatile uint32_t c_seq;	// Bumped by each signal
+};
+
+struct Sem {
+	volatile uint32_t s_count;
+	volatile uint32_t s_waiters;	// Envs in or about to be in a wait
+};
+
+void	mutex_init(struct Mutex *m);
+void	mutex_lock(struct Mutex *m);
+bool	mutex_trylock(struct Mutex *m);
+void	mutex_unlock(struct Mutex *m);
+void	cond_init(struct Cond *c);
+int	cond_wait(struct Cond *c, struct Mutex *m, uint32_t timeout);
+void	cond_signal(struct Cond *c);
+void	cond_broadcast(struct Cond *c);
+void	sem_init(struct Sem *s, uint32_t count);
+int	sem_wait(struct Sem *s, uint32_t timeout);
+bool	sem_trywait(struct Sem *s);
+void	sem_post(struct Sem *s);
+
+// thread.c
+envid_t	thread_create(void (*fn)(void *), void *arg);
+void	thread_exit(void) __attribute__((noreturn));
+
+// uring.c
+int	ring_init(void *va, uint32_t flags);
+int	ring_queue(uint32_t tag, uint32_t num, uint32_t a1, uint32_t a2,
+		   uint32_t a3, uint32_t a4, uint32_t a5);
+int	ring_submit(void);
+int	ring_reap(struct URingCqe *cqe);
+
+// vdata.c
+envid_t	getenvid(void);
+uint64_t gettime(void);
+
+// pgfault.c
+void	set_pgfault_handler(void (*handler)(struct UTrapframe *utf));
+
 // readline.c
 char*	readline(const char *buf);
 
 // syscall.c
+extern bool syscall_sysenter;
 void	sys_cputs(const char *string, size_t len);
 int	sys_cgetc(void);
 envid_t	sys_getenvid(void);
 int	sys_env_destroy(envid_t);
+void	sys_yield(void);
+int	sys_page_alloc(envid_t env, void *pg, int perm);
+int	sys_page_map(envid_t src_env, void *src_pg,
+		     envid_t dst_env, void *dst_pg, int perm);
+int	sys_page_unmap(envid_t env, void *pg);
+int	sys_env_set_status(envid_t env, int status);
+int	sys_env_set_pgfault_upcall(envid_t env, void *upcall);
+envid_t	sys_env_snapshot(void);
+envid_t	sys_env_clone(envid_t tmpl);
+envid_t	sys_thread_create(void (*fn)(void *), void *arg, void (*ret)(void));
+int	sys_rgroup_create(uint32_t weight, uint32_t page_limit,
+			  uint32_t rt_limit);
+int	sys_env_set_rgroup(envid_t env, uint32_t gid);
+int	sys_rgroup_destroy(uint32_t gid);
+int	sys_env_spawn(const char *name, uint32_t n, envid_t *ids);
+void	sys_yield_to(envid_t env);
+int	sys_env_set_rt(envid_t env, uint32_t runtime, uint32_t period,
+		       uint32_t deadline);
+int	sys_rt_wait(void);
+int	sys_ring_setup(void *va);
+int	sys_ring_enter(void);
+int	sys_batch(struct SyscallDesc *v, int n);
+int	sys_ipc_try_send(envid_t to_env, uint32_t value, void *pg, int perm);
+envid_t	sys_ipc_recv(void *dstva, uint32_t *value, int *perm);
+envid_t	sys_ipc_call(envid_t to_env, uint32_t value, void *pg, int perm,
+		     uint32_t *value_store, int *perm_store);
+int	sys_futex_wait(volatile uint32_t *addr, uint32_t val,
+		       uint32_t timeout);
+int	sys_futex_wake(volatile uint32_t *addr, uint32_t n);
+int	sys_chan_create(envid_t peer, void *va, void *peerva, uint32_t npages);
+int	sys_shm_create(const char *name, uint32_t npages, void *va, int perm);
+int	sys_shm_lookup(const char *name);
+int	sys_shm_attach(int handle, void *va, int perm);
+int	sys_shm_detach(int handle, void *va);
 
+// This must be inlined.  Exercise for reader: why?
+static inline envid_t __attribute__((always_inline))
+sys_exofork(void)
+{
+	envid_t ret;
+	asm volatile("int %2"
+		     : "=a" (ret)
+		     : "a" (SYS_exofork), "i" (T_SYSCALL));
+	return ret;
+}
 
 
 /* File open modes */
@@ -17,6 +17,7 @@
 #define GD_UT     0x18     // user text
 #define GD_UD     0x20     // user data
 #define GD_TSS0   0x28     // Task segment selector for CPU 0
+#define GD_PERCPU0 0x68    // Per-CPU data segment for CPU 0 (after NCPU TSSs)
 
 /*
  * Virtual memory map:                                Permissions
@@ -45,19 +46,28 @@
  *                     :              .               :                   |
  *    MMIOLIM ------>  +------------------------------+ 0xefc00000      --+
  *                     |       Memory-mapped I/O      | RW/--  PTSIZE
- * ULIM, MMIOBASE -->  +------------------------------+ 0xef800000
+ *    MMIOBASE ----->  +------------------------------+ 0xef800000
+ *                     |          ENVS (**)           | RW/--  ENVS_SPAN
+ *    ULIM, KENVS -->  +------------------------------+ 0xee800000
  *                     |  Cur. Page Table (User R-)   | R-/R-  PTSIZE
- *    UVPT      ---->  +------------------------------+ 0xef400000
+ *    UVPT      ---->  +------------------------------+ 0xee400000
  *                     |          RO PAGES            | R-/R-  PTSIZE
- *    UPAGES    ---->  +------------------------------+ 0xef000000
- *                     |           RO ENVS            | R-/R-  PTSIZE
- * UTOP,UENVS ------>  +------------------------------+ 0xeec00000
+ *    UPAGES    ---->  +------------------------------+ 0xee000000
+ *                     |         RO ENVS (**)         | R-/R-  ENVS_SPAN
+ *    UENVS  ------->  +------------------------------+ 0xed000000
+ *                     |       Invalid Memory (*)     | --/--
+ *                     | - - - - - - - - - - - - - - -|                 PTSIZE
+ *                     | Env Data (User R-, per-env)  | R-/R-  PGSIZE
+ * UTOP,UVDATA ----->  +------------------------------+ 0xecc00000
  * UXSTACKTOP -/       |     User Exception Stack     | RW/RW  PGSIZE
- *                     +------------------------------+ 0xeebff000
+ *                     +------------------------------+ 0xecbff000
  *                     |       Empty Memory (*)       | --/--  PGSIZE
- *    USTACKTOP  --->  +------------------------------+ 0xeebfe000
+ *    USTACKTOP  --->  +------------------------------+ 0xecbfe000
  *                     |      Normal User Stack       | RW/RW  PGSIZE
- *                     +------------------------------+ 0xeebfd000
+ *                     +------------------------------+ 0xecbfd000
+ *                     |  Thread Stacks, Exception    | RW/RW  (NTHREADS-1)*UTSTACKSLOT
+ *                     |  Stacks and Guards           |        + 3*PGSIZE
+ *                     +------------------------------+ 0xecb7e000
  *                     |                              |
  *                     |                              |
  *                     ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
@@ -80,6 +90,8 @@
  * (*) Note: The kernel ensures that "Invalid Memory" is *never* mapped.
  *     "Empty Memory" is normally unmapped, but user programs may map pages
  *     there if desired.  JOS user programs map pages temporarily at UTEMP.
+ * (**) Note: The env table grows a page at a time.  KENVS maps only the
+ *     pages in use; UENVS maps a zero page (all ENV_FREE) for the rest.
  */
 
 
@@ -96,12 +108,17 @@
 #define KSTACKTOP	KERNBASE
 #define KSTKSIZE	(8*PGSIZE)   		// size of a kernel stack
 #define KSTKGAP		(8*PGSIZE)   		// size of a kernel stack guard
+#define KSTACKTOP_CPU(i)	(KSTACKTOP - (i) * (KSTKSIZE + KSTKGAP))
 
 // Memory-mapped IO.
 #define MMIOLIM		(KSTACKTOP - PTSIZE)
 #define MMIOBASE	(MMIOLIM - PTSIZE)
 
-#define ULIM		(MMIOBASE)
+// The env table, read-write for the kernel (see UENVS).
+#define ENVS_SPAN	(4*PTSIZE)		// VA reserved for the env table
+#define KENVS		(MMIOBASE - ENVS_SPAN)
+
+#define ULIM		(KENVS)
 
 /*
  * User read-only mappings! Anything below here til UTOP are readonly to user.
@@ -113,19 +130,29 @@
 // Read-only copies of the Page structures
 #define UPAGES		(UVPT - PTSIZE)
 // Read-only copies of the global env structures
-#define UENVS		(UPAGES - PTSIZE)
+#define UENVS		(UPAGES - ENVS_SPAN)
+// Read-only data page of each address space (see inc/vdata.h), in a
+// page table of its own
+#define UVDATA		(UENVS - PTSIZE)
 
 /*
  * Top of user VM. User can manipulate VA from UTOP-1 and down!
  */
 
 // Top of user-accessible VM
-#define UTOP		UENVS
+#define UTOP		UVDATA
 // Top of one-page user exception stack
 #define UXSTACKTOP	UTOP
 // Next page left invalid to guard against exception stack overflow; then:
 // Top of normal user stack
 #define USTACKTOP	(UTOP - 2*PGSIZE)
+// Thread t of an address space has the stack page just below
+// USTACKTOP - t*UTSTACKSLOT, over an unmapped guard page, and then
+// its exception stack page over another guard page; thread 0 runs on
+// the normal user stack, and takes exceptions on the one at UXSTACKTOP.
+#define UTSTACKSLOT	(4*PGSIZE)
+#define NTHREADS	32
+#define UTXSTACKTOP(t)	((t) ? USTACKTOP - (t)*UTSTACKSLOT - 2*PGSIZE : UXSTACKTOP)
 
 // Where user programs generally begin
 #define UTEXT		(2*PTSIZE)
@@ -138,6 +165,9 @@
 // The location of the user-level STABS data structure
 #define USTABDATA	(PTSIZE / 2)
 
+// Physical address of startup code for non-boot CPUs (APs)
+#define MPENTRY_PADDR	0x7000
+
 #ifndef __ASSEMBLER__
 
 typedef uint32_t pte_t;
@@ -182,6 +212,10 @@ struct PageInfo {
 	// boot_alloc do not have valid reference count fields.
 
 	uint16_t pp_ref;
+
+	// Resource group charged for this page plus one, or 0 if none
+	// (see kern/rgroup.c).
+	uint16_t pp_rgroup;
 };
 
 #endif /* !__ASSEMBLER__ */
@@ -54,6 +54,8 @@
 #define PTXSHIFT	12		// offset of PTX in a linear address
 #define PDXSHIFT	22		// offset of PDX in a linear address
 
+#define CACHELINE	64		// bytes per cache line (for alignment)
+
 // Page table/directory entry flags.
 #define PTE_P		0x001	// Present
 #define PTE_W		0x002	// Writeable
@@ -68,6 +70,8 @@
 // The PTE_AVAIL bits aren't used by the kernel or interpreted by the
 // hardware, so user processes are allowed to set them arbitrarily.
 #define PTE_AVAIL	0xE00	// Available for software use
+#define PTE_COW		0x800	// Copy-on-write (one of the PTE_AVAIL bits)
+#define PTE_SHARE	0x400	// Shared, not copy-on-write, on env_snapshot
 
 // Flags in PTE_SYSCALL may be used in system calls.  (Others may not.)
 #define PTE_SYSCALL	(PTE_AVAIL | PTE_P | PTE_W | PTE_U)
@@ -96,6 +100,14 @@
 #define CR4_PVI		0x00000002	// Protected-Mode Virtual Interrupts
 #define CR4_VME		0x00000001	// V86 Mode Extensions
 
+// Model-specific registers for sysenter/sysexit
+#define MSR_SYSENTER_CS		0x174	// Kernel cs; ss is cs + 8
+#define MSR_SYSENTER_ESP	0x175	// Kernel esp
+#define MSR_SYSENTER_EIP	0x176	// Kernel entry point
+
+// CPUID leaf 1 feature flags in %edx
+#define CPUID_SEP	0x00000800	// sysenter/sysexit
+
 // Eflags register
 #define FL_CF		0x00000001	// Carry Flag
 #define FL_PF		0x00000004	// Parity Flag
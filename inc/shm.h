@@ -0,0 +1,12 @@
+#ifndef JOS_INC_SHM_H
+#define JOS_INC_SHM_H
+
+// Named shared-memory segments (see sys_shm_create).  A segment is a
+// set of pages that any env can attach, at an address and with
+// permissions of its choosing, by the segment's name or its handle.
+// The segment lives until its last attachment is detached, or dies
+// with its env.
+#define SHM_NAMELEN	32	// Longest name, including the NUL
+#define SHM_MAXPAGES	256	// Pages in a segment
+
+#endif	// !JOS_INC_SHM_H
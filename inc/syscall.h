@@ -1,13 +1,54 @@
 #ifndef JOS_INC_SYSCALL_H
 #define JOS_INC_SYSCALL_H
 
+#include <inc/types.h>
+
 /* system call numbers */
 enum {
 	SYS_cputs = 0,
 	SYS_cgetc,
 	SYS_getenvid,
 	SYS_env_destroy,
+	SYS_yield,
+	SYS_page_alloc,
+	SYS_page_map,
+	SYS_page_unmap,
+	SYS_exofork,
+	SYS_env_set_status,
+	SYS_env_snapshot,
+	SYS_env_clone,
+	SYS_thread_create,
+	SYS_rgroup_create,
+	SYS_env_set_rgroup,
+	SYS_env_spawn,
+	SYS_yield_to,
+	SYS_env_set_rt,
+	SYS_rt_wait,
+	SYS_ring_setup,
+	SYS_ring_enter,
+	SYS_batch,
+	SYS_ipc_try_send,
+	SYS_ipc_recv,
+	SYS_ipc_call,
+	SYS_futex_wait,
+	SYS_futex_wake,
+	SYS_chan_create,
+	SYS_env_set_pgfault_upcall,
+	SYS_shm_create,
+	SYS_shm_lookup,
+	SYS_shm_attach,
+	SYS_shm_detach,
+	SYS_rgroup_destroy,
 	NSYSCALLS
 };
 
+// One entry of a sys_batch() vector.  The kernel fills in sd_ret.
+#define SYS_BATCH_MAX	32	// Entries per sys_batch() call
+
+struct SyscallDesc {
+	uint32_t sd_num;		// System call number
+	uint32_t sd_args[5];
+	int32_t sd_ret;			// The call's return value
+};
+
 #endif /* !JOS_INC_SYSCALL_H */
@@ -0,0 +1,47 @@
+#ifndef JOS_INC_URING_H
+#define JOS_INC_URING_H
+
+#include <inc/types.h>
+
+// A system call ring: one page, shared by an env and the kernel (see
+// sys_ring_setup), holding a submission queue of system calls and a
+// completion queue of their results.
+//
+// The env fills in ur_sq[ur_sq_tail % URING_NENTRY] and then advances
+// ur_sq_tail.  The kernel takes entries from ur_sq_head, runs each one
+// and posts its result at ur_cq[ur_cq_tail % URING_NENTRY], and the
+// env takes completions from ur_cq_head.  Indices only ever increase.
+// Each side writes only its own two indices.
+//
+// The kernel drains the ring on sys_ring_enter, and, if URING_POLL is
+// set, whenever the env enters the kernel for any other reason, such
+// as a timer interrupt.  Only calls that return without switching envs
+// may be queued (see syscall_batchable); others complete with -E_INVAL.
+#define URING_NENTRY	64	// Entries in each queue; a power of two
+
+// Flags in ur_flags, set by the env
+#define URING_POLL	0x1	// Drain the ring on every kernel entry
+
+struct URingSqe {
+	uint32_t sqe_num;		// System call number
+	uint32_t sqe_args[5];
+	uint32_t sqe_tag;		// Copied into the completion
+	uint32_t sqe_pad;
+};
+
+struct URingCqe {
+	uint32_t cqe_tag;
+	int32_t cqe_res;		// The system call's return value
+};
+
+struct URing {
+	volatile uint32_t ur_sq_head;	// Written by the kernel
+	volatile uint32_t ur_sq_tail;	// Written by the env
+	volatile uint32_t ur_cq_head;	// Written by the env
+	volatile uint32_t ur_cq_tail;	// Written by the kernel
+	volatile uint32_t ur_flags;
+	struct URingSqe ur_sq[URING_NENTRY];
+	struct URingCqe ur_cq[URING_NENTRY];
+};
+
+#endif /* !JOS_INC_URING_H */
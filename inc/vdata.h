@@ -0,0 +1,28 @@
+#ifndef JOS_INC_VDATA_H
+#define JOS_INC_VDATA_H
+
+#include <inc/types.h>
+#include <inc/memlayout.h>
+#include <inc/env.h>
+
+// The page at UVDATA, which the kernel keeps up to date and each
+// address space maps read-only, so that user code can learn its
+// envid and the time without a system call (see lib/vdata.c).
+//
+// Time is counted by the TSC, which the kernel calibrates at boot.
+// Microseconds since vd_tsc_boot are
+//	(tsc - vd_tsc_boot) * vd_us_mult / 2^32.
+struct VData {
+	uint64_t vd_tsc_boot;		// TSC when the clock started
+	uint32_t vd_tsc_khz;		// TSC cycles per millisecond
+	uint32_t vd_us_mult;		// 2^32 * 1000 / vd_tsc_khz
+
+	// Threads of the address space, by env_tid
+	uint32_t vd_tids;		// env_tids in use, one bit each
+	struct {
+		envid_t vt_envid;
+		uint32_t vt_cpu;	// CPU the thread last ran on
+	} vd_threads[NTHREADS];
+};
+
+#endif /* !JOS_INC_VDATA_H */
@@ -2,6 +2,7 @@
 #define JOS_INC_X86_H
 
 #include <inc/types.h>
+#include <inc/mmu.h>
 
 static inline void
 breakpoint(void)
@@ -240,6 +241,26 @@ cpuid(uint32_t info, uint32_t *eaxp, uint32_t *ebxp, uint32_t *ecxp, uint32_t *e
 		*edxp = edx;
 }
 
+// Whether this CPU has sysenter and sysexit.  Early Pentium Pros
+// report the feature without implementing it.
+static inline bool
+cpu_has_sysenter(void)
+{
+	uint32_t eax, edx;
+
+	cpuid(1, &eax, NULL, NULL, &edx);
+	if (((eax >> 8) & 0xf) == 6 && ((eax >> 4) & 0xf) < 3
+	    && (eax & 0xf) < 3)
+		return 0;
+	return (edx & CPUID_SEP) != 0;
+}
+
+static inline void
+wrmsr(uint32_t msr, uint64_t val)
+{
+	asm volatile("wrmsr" : : "c" (msr), "A" (val));
+}
+
 static inline uint64_t
 read_tsc(void)
 {
@@ -253,12 +274,38 @@ xchg(volatile uint32_t *addr, uint32_t newval)
 {
 	uint32_t result;
 
-	// The + in "+m" denotes a read-modify-write operand.
+	// The + in "+m" denotes a read-modify-write operand.  The
+	// "memory" clobber keeps the compiler from moving other loads
+	// and stores across it, as lock code needs.
 	asm volatile("lock; xchgl %0, %1"
 		     : "+m" (*addr), "=a" (result)
 		     : "1" (newval)
-		     : "cc");
+		     : "cc", "memory");
+	return result;
+}
+
+// Atomically set *addr to newval if it holds oldval.  Returns the
+// value *addr held.  Also a compiler barrier.
+static inline uint32_t
+cmpxchg(volatile uint32_t *addr, uint32_t oldval, uint32_t newval)
+{
+	uint32_t result;
+
+	asm volatile("lock; cmpxchgl %2, %1"
+		     : "=a" (result), "+m" (*addr)
+		     : "r" (newval), "0" (oldval)
+		     : "cc", "memory");
 	return result;
 }
 
+// Atomically add n to *addr.  Returns the value *addr held before.
+static inline uint32_t
+atomic_add(volatile uint32_t *addr, uint32_t n)
+{
+	asm volatile("lock; xaddl %0, %1"
+		     : "+r" (n), "+m" (*addr)
+		     : : "cc", "memory");
+	return n;
+}
+
 #endif /* !JOS_INC_X86_H */
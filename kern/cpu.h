@@ -0,0 +1,91 @@
+
+#ifndef JOS_INC_CPU_H
+#define JOS_INC_CPU_H
+
+#include <inc/types.h>
+#include <inc/memlayout.h>
+#include <inc/mmu.h>
+#include <inc/env.h>
+#include <inc/assert.h>
+
+// Maximum number of CPUs
+#define NCPU  8
+
+// Values of status in struct Cpu
+enum {
+	CPU_UNUSED = 0,
+	CPU_STARTED,
+	CPU_HALTED,
+};
+
+struct RunQueue;
+
+// Per-CPU state.  Each CPU's %gs selects a segment based at its own
+// CpuInfo, so the fields can be reached with this_cpu_read() and
+// this_cpu_write() below instead of indexing cpus[] by cpunum().
+struct CpuInfo {
+	struct CpuInfo *cpu_self;       // Points to this CpuInfo
+	uint8_t cpu_id;                 // Local APIC ID; index into cpus[] below
+	volatile unsigned cpu_status;   // The status of the CPU
+	struct Env *cpu_env;            // The currently-running environment.
+	struct RunQueue *cpu_rq;        // This CPU's run queue
+	pde_t *cpu_pgdir;               // Page directory loaded (see tlb.c)
+	uint32_t cpu_ntraps;            // Traps taken by this CPU
+	uint64_t cpu_tsc;               // TSC when we last entered or left
+	                                // user mode (see env_run, trap)
+	uint32_t cpu_swreason;          // Why sched_yield() was called
+	struct Taskstate cpu_ts;        // Used by x86 to find stack for interrupt
+} __attribute__((aligned(CACHELINE)));
+
+// Initialized in mpconfig.c
+extern struct CpuInfo cpus[NCPU];
+extern int ncpu;                    // Total number of CPUs in the system
+extern struct CpuInfo *bootcpu;     // The boot-strap processor (BSP)
+extern physaddr_t lapicaddr;        // Physical MMIO address of the local APIC
+
+// Per-CPU kernel stacks
+extern unsigned char percpu_kstacks[NCPU][KSTKSIZE];
+
+int cpunum(void);
+
+// Access a 32-bit field of the current CPU's CpuInfo through %gs.
+// This is a single segment-relative load or store, where cpunum()
+// costs a read of the local APIC's MMIO ID register.
+#define this_cpu_read(field)						\
+({									\
+	typeof(((struct CpuInfo *) 0)->field) __v;			\
+	static_assert(sizeof(__v) == 4);				\
+	asm volatile("movl %%gs:%c1, %0"				\
+		     : "=r" (__v)					\
+		     : "i" (offsetof(struct CpuInfo, field)));		\
+	__v;								\
+})
+
+#define this_cpu_write(field, val)					\
+do {									\
+	typeof(((struct CpuInfo *) 0)->field) __v = (val);		\
+	static_assert(sizeof(__v) == 4);				\
+	asm volatile("movl %0, %%gs:%c1"				\
+		     : : "r" (__v),					\
+		       "i" (offsetof(struct CpuInfo, field))		\
+		     : "memory");					\
+} while (0)
+
+#define this_cpu_inc(field)						\
+do {									\
+	static_assert(sizeof(((struct CpuInfo *) 0)->field) == 4);	\
+	asm volatile("incl %%gs:%c0"					\
+		     : : "i" (offsetof(struct CpuInfo, field))		\
+		     : "memory", "cc");					\
+} while (0)
+
+#define thiscpu this_cpu_read(cpu_self)
+
+void mp_init(void);
+void lapic_init(void);
+void lapic_startap(uint8_t apicid, uint32_t addr);
+void lapic_eoi(void);
+void lapic_ipi(int vector);
+void lapic_ipi_cpu(int apicid, int vector);
+
+#endif
@@ -6,18 +6,35 @@
 #include <inc/string.h>
 #include <inc/assert.h>
 #include <inc/elf.h>
+#include <inc/syscall.h>
+#include <inc/vdata.h>
 
 #include <kern/env.h>
 #include <kern/pmap.h>
 #include <kern/trap.h>
 #include <kern/monitor.h>
+#include <kern/sched.h>
+#include <kern/cpu.h>
+#include <kern/spinlock.h>
+#include <kern/tlb.h>
+#include <kern/kthread.h>
+#include <kern/rgroup.h>
+#include <kern/uring.h>
+#include <kern/futex.h>
+#include <kern/shm.h>
+#include <kern/kclock.h>
 
 struct Env *envs = NULL;		// All environments
-struct Env *curenv = NULL;		// The current env
+uint32_t nenvs;				// Length of the mapped part of envs[]
+static size_t envs_mapped;		// Bytes of envs[] mapped
+// Pages of struct EnvCold, one per ENV_COLD_PER_PAGE envs in envs[]
+struct EnvCold *env_cold_pages[(NENV + ENV_COLD_PER_PAGE - 1)
+			       / ENV_COLD_PER_PAGE];
 static struct Env *env_free_list;	// Free environment list
 					// (linked by Env->env_link)
+struct EnvReapStats env_reap_stats;
 
-#define ENVGENSHIFT	12		// >= LOGNENV
+#define ENVGENSHIFT	16		// >= LOGNENV
 
 // Global descriptor table.
 //
@@ -34,7 +51,7 @@ static struct Env *env_free_list;	// Free environment list
 // definition of gdt specifies the Descriptor Privilege Level (DPL)
 // of that descriptor: 0 for kernel and 3 for user.
 //
-struct Segdesc gdt[] =
+struct Segdesc gdt[2 * NCPU + 5] =
 {
 	// 0x0 - unused (always faults -- for trapping NULL far pointers)
 	SEG_NULL,
@@ -51,8 +68,13 @@ struct Segdesc gdt[] =
 	// 0x20 - user data segment
 	[GD_UD >> 3] = SEG(STA_W, 0x0, 0xffffffff, 3),
 
-	// 0x28 - tss, initialized in trap_init_percpu()
-	[GD_TSS0 >> 3] = SEG_NULL
+	// Per-CPU TSS descriptors (starting from GD_TSS0) are initialized
+	// in trap_init_percpu()
+	[GD_TSS0 >> 3] = SEG_NULL,
+
+	// Per-CPU data segments (starting from GD_PERCPU0) are initialized
+	// in env_init_percpu()
+	[GD_PERCPU0 >> 3] = SEG_NULL
 };
 
 struct Pseudodesc gdt_pd = {
@@ -85,8 +107,14 @@ envid2env(envid_t envid, struct Env **env_store, bool checkperm)
 	// to ensure that the envid is not stale
 	// (i.e., does not refer to a _previous_ environment
 	// that used the same slot in the envs[] array).
+	// A dying environment's envid is already dead.
+	if (ENVX(envid) >= nenvs) {
+		*env_store = 0;
+		return -E_BAD_ENV;
+	}
 	e = &envs[ENVX(envid)];
-	if (e->env_status == ENV_FREE || e->env_id != envid) {
+	if (e->env_status == ENV_FREE || e->env_status == ENV_DYING
+	    || e->env_id != envid) {
 		*env_store = 0;
 		return -E_BAD_ENV;
 	}
@@ -105,24 +133,93 @@ envid2env(envid_t envid, struct Env **env_store, bool checkperm)
 	return 0;
 }
 
-// Mark all environments in 'envs' as free, set their env_ids to 0,
-// and insert them into the env_free_list.
-// Make sure the environments are in the free list in the same order
-// they are in the envs array (i.e., so that the first call to
-// env_alloc() returns envs[0]).
+//
+// Map one more page of envs[], at KENVS for the kernel and at UENVS for
+// users, and put the environments it completes on the free list, after
+// making sure env_cold_pages[] covers them.
+// mem_init() created the page tables for both windows, so every env's
+// page directory sees the new page at once.  The UENVS window mapped
+// the zero page before, and any CPU may still cache that: changes to
+// kern_pgdir are shot down on all CPUs (see kern/tlb.c), and the batch
+// is sent here, before any env in the new page is handed out.
+//
+// Returns 0 on success, < 0 on failure.  Errors include:
+//	-E_NO_FREE_ENV if envs[] already holds NENV environments
+//	-E_NO_MEM on memory exhaustion
+//
+static int
+env_grow(void)
+{
+	struct PageInfo *pp;
+	uint32_t i, n;
+	int r;
+
+	if (nenvs == NENV)
+		return -E_NO_FREE_ENV;
+	n = MIN((envs_mapped + PGSIZE) / sizeof(struct Env), NENV);
+	for (i = nenvs; i < n; i += ENV_COLD_PER_PAGE - i % ENV_COLD_PER_PAGE)
+		if (!env_cold_pages[i / ENV_COLD_PER_PAGE]) {
+			if (!(pp = page_alloc(ALLOC_ZERO)))
+				return -E_NO_MEM;
+			pp->pp_ref++;
+			env_cold_pages[i / ENV_COLD_PER_PAGE] = page2kva(pp);
+		}
+	if (!(pp = page_alloc(ALLOC_ZERO)))
+		return -E_NO_MEM;
+	if ((r = page_insert(kern_pgdir, pp, (void *) (KENVS + envs_mapped),
+			     PTE_W)) < 0) {
+		page_free(pp);
+		return r;
+	}
+	if ((r = page_insert(kern_pgdir, pp, (void *) (UENVS + envs_mapped),
+			     PTE_U)) < 0) {
+		page_remove(kern_pgdir, (void *) (KENVS + envs_mapped));
+		return r;
+	}
+	envs_mapped += PGSIZE;
+	tlb_flush();
+
+	// Mark the new environments free, set their env_ids to 0, and
+	// insert them into the env_free_list in the same order they are
+	// in the envs array (so that env_alloc() hands out envs[0] first).
+	for (i = n; i-- > nenvs; ) {
+		envs[i].env_id = 0;
+		envs[i].env_status = ENV_FREE;
+		envs[i].env_rq = -1;
+		envs[i].env_link = env_free_list;
+		env_free_list = &envs[i];
+	}
+	nenvs = n;
+	return 0;
+}
+
+// Start with an empty envs[]; env_alloc() grows it as needed.
 //
 void
 env_init(void)
 {
 	// Set up envs array
 	// LAB 3: Your code here.
+	static_assert(NENV * sizeof(struct Env) <= ENVS_SPAN);
+	// What user code may read at UENVS stays where it always was.
+	static_assert(offsetof(struct Env, env_tf) == 0);
+	static_assert(offsetof(struct Env, env_link) == 68);
+	static_assert(offsetof(struct Env, env_id) == 72);
+	static_assert(offsetof(struct Env, env_parent_id) == 76);
+	static_assert(offsetof(struct Env, env_type) == 80);
+	static_assert(offsetof(struct Env, env_status) == 84);
+	static_assert(offsetof(struct Env, env_runs) == 88);
+	static_assert(offsetof(struct Env, env_pgdir) == 92);
+	static_assert(offsetof(struct Env, env_tid) == 116);
+	static_assert(offsetof(struct Env, env_stats) == 2 * CACHELINE);
+	static_assert(sizeof(struct Env) == 8 * CACHELINE);
+	// The scheduling fields are a byte wide each.
+	static_assert(NCPU <= 127 && NRGROUP <= 256 && NRTENV < 255);
+	static_assert(NENV <= (1 << ENVGENSHIFT));
+	static_assert(NSYSCALLS <= ENV_NSYSCALLSTAT);
 	env_free_list = NULL;
-	for (int counter = NENV - 1; counter >= 0; --counter) {
-		envs[counter].env_id = 0;
-		envs[counter].env_status = ENV_FREE;
-		envs[counter].env_link = env_free_list;
-		env_free_list = &envs[counter];
-	}
+	nenvs = 0;
+
 	// Per-CPU part of the initialization
 	env_init_percpu();
 }
@@ -131,10 +228,22 @@ env_init(void)
 void
 env_init_percpu(void)
 {
+	int i = cpunum();
+
+	static_assert(GD_PERCPU0 == GD_TSS0 + (NCPU << 3));
+
+	// Point this CPU's data segment at its CpuInfo so that
+	// this_cpu_read() and friends work.  _alltraps reloads GS with
+	// this selector on every trap from user mode.
+	cpus[i].cpu_self = &cpus[i];
+	// SEG16 gives a byte-granular limit, so stray offsets fault.
+	gdt[(GD_PERCPU0 >> 3) + i] = SEG16(STA_W, (uint32_t) &cpus[i],
+					  sizeof(struct CpuInfo) - 1, 0);
+
 	lgdt(&gdt_pd);
-	// The kernel never uses GS or FS, so we leave those set to
-	// the user data segment.
-	asm volatile("movw %%ax,%%gs" : : "a" (GD_UD|3));
+	asm volatile("movw %%ax,%%gs" : : "a" (GD_PERCPU0 + (i << 3)));
+	// The kernel never uses FS, so we leave it set to the user
+	// data segment.
 	asm volatile("movw %%ax,%%fs" : : "a" (GD_UD|3));
 	// The kernel does use ES, DS, and SS.  We'll change between
 	// the kernel and user data segments as needed.
@@ -162,7 +271,7 @@ static int
 env_setup_vm(struct Env *e)
 {
 	int i;
-	struct PageInfo *p = NULL;
+	struct PageInfo *p = NULL, *vp = NULL;
 
 	// Allocate a page for the page directory
 	if (!(p = page_alloc(ALLOC_ZERO)))
@@ -193,42 +302,94 @@ env_setup_vm(struct Env *e)
 	// Permissions: kernel R, user R
 	e->env_pgdir[PDX(UVPT)] = PADDR(e->env_pgdir) | PTE_P | PTE_U;
 
+	// UVDATA maps the address space's data page read-only.
+	// Permissions: kernel RW, user R
+	if (!(vp = page_alloc(ALLOC_ZERO))
+	    || page_insert(e->env_pgdir, vp, (void *) UVDATA,
+			   PTE_P | PTE_U) < 0) {
+		if (vp)
+			page_free(vp);
+		page_decref(p);
+		return -E_NO_MEM;
+	}
+	e->env_vdata = page2kva(vp);
+	e->env_vdata->vd_tsc_boot = tsc_boot;
+	e->env_vdata->vd_tsc_khz = tsc_khz;
+	e->env_vdata->vd_us_mult = ((uint64_t) 1000 << 32) / tsc_khz;
+
 	return 0;
 }
 
 //
-// Allocates and initializes a new environment.
-// On success, the new environment is stored in *newenv_store.
+// Free pgdir, which maps nothing below UTOP any more, along with its
+// UVDATA page and that page's page table.
 //
-// Returns 0 on success, < 0 on failure.  Errors include:
-//	-E_NO_FREE_ENV if all NENV environments are allocated
-//	-E_NO_MEM on memory exhaustion
+static void
+env_free_pgdir(pde_t *pgdir)
+{
+	struct PageInfo *pt = pa2page(PTE_ADDR(pgdir[PDX(UVDATA)]));
+
+	page_remove(pgdir, (void *) UVDATA);
+	pgdir[PDX(UVDATA)] = 0;
+	page_decref(pt);
+	page_decref(pa2page(PADDR(pgdir)));
+}
+
 //
-int
-env_alloc(struct Env **newenv_store, envid_t parent_id)
+// Take an Env off the free list and give it an env_id and initial state.
+// If pgdir is NULL the env gets a new address space of its own, as
+// thread 0; otherwise it runs in pgdir, with UVDATA page vdata, and the
+// caller accounts for that.
+//
+static int
+env_alloc_common(struct Env **newenv_store, envid_t parent_id,
+		 pde_t *pgdir, struct VData *vdata)
 {
 	int32_t generation;
 	int r;
-	struct Env *e;
+	struct Env *e, *parent;
 
-	if (!(e = env_free_list))
-		return -E_NO_FREE_ENV;
+	while (!(e = env_free_list))
+		if ((r = env_grow()) < 0)
+			return r;
 
 	// Allocate and set up the page directory for this environment.
-	if ((r = env_setup_vm(e)) < 0)
-		return r;
+	if (!pgdir) {
+		if ((r = env_setup_vm(e)) < 0)
+			return r;
+	} else {
+		e->env_pgdir = pgdir;
+		e->env_vdata = vdata;
+	}
 
 	// Generate an env_id for this environment.
 	generation = (e->env_id + (1 << ENVGENSHIFT)) & ~(NENV - 1);
 	if (generation <= 0)	// Don't create a negative env_id.
 		generation = 1 << ENVGENSHIFT;
 	e->env_id = generation | (e - envs);
+	if (!pgdir) {
+		e->env_vdata->vd_tids = 1 << 0;
+		e->env_vdata->vd_threads[0].vt_envid = e->env_id;
+	}
 
 	// Set the basic status variables.
 	e->env_parent_id = parent_id;
 	e->env_type = ENV_TYPE_USER;
 	e->env_status = ENV_RUNNABLE;
 	e->env_runs = 0;
+	e->env_tid = 0;
+	e->env_rt = 0;
+	memset(env_cold(e), 0, sizeof(struct EnvCold));
+	memset(&e->env_stats, 0, sizeof(e->env_stats));
+
+	// Join the parent's resource group; the kernel's envs are in
+	// the root group.
+	if (parent_id && envid2env(parent_id, &parent, 0) == 0)
+		e->env_rgroup = parent->env_rgroup;
+	else
+		e->env_rgroup = 0;
+	rgroups[e->env_rgroup].rg_nenvs++;
+	e->env_cpunum = -1;
 
 	// Clear out all the saved register state,
 	// to prevent the register values
@@ -251,14 +412,54 @@ env_alloc(struct Env **newenv_store, envid_t parent_id)
 	e->env_tf.tf_cs = GD_UT | 3;
 	// You will set e->env_tf.tf_eip later.
 
+	// Enable interrupts while in user mode.
+	e->env_tf.tf_eflags |= FL_IF;
+
 	// commit the allocation
 	env_free_list = e->env_link;
 	*newenv_store = e;
 
+	// Runnable envs always live on some CPU's run queue.
+	sched_enqueue(e);
+
 	cprintf("[%08x] new env %08x\n", curenv ? curenv->env_id : 0, e->env_id);
 	return 0;
 }
 
+//
+// Allocates and initializes a new environment.
+// On success, the new environment is stored in *newenv_store.
+//
+// Returns 0 on success, < 0 on failure.  Errors include:
+//	-E_NO_FREE_ENV if all NENV environments are allocated
+//	-E_NO_MEM if envs[] must grow but there is no memory
+//	-E_NO_MEM on memory exhaustion
+//
+int
+env_alloc(struct Env **newenv_store, envid_t parent_id)
+{
+	return env_alloc_common(newenv_store, parent_id, NULL, NULL);
+}
+
+//
+// Like env_alloc(), but the new environment runs in the existing
+// address space pgdir, with UVDATA page vdata (NULL for kernel
+// threads), instead of getting one of its own.  Its env_tid is 0; the
+// caller must take a reference to pgdir if it counts threads, and set
+// the thread number.
+//
+// Returns 0 on success, < 0 on failure.  Errors include:
+//	-E_NO_FREE_ENV if all NENV environments are allocated
+//	-E_NO_MEM if envs[] must grow but there is no memory
+//
+int
+env_alloc_in(struct Env **newenv_store, envid_t parent_id, pde_t *pgdir,
+	     struct VData *vdata)
+{
+	assert(pgdir);
+	return env_alloc_common(newenv_store, parent_id, pgdir, vdata);
+}
+
 //
 // Allocate len bytes of physical memory for environment env,
 // and map it at virtual address va in the environment's address space.
@@ -287,6 +488,52 @@ region_alloc(struct Env *e, void *va, size_t len)
 	}
 }
 
+//
+// Map ELF segment ph of binary into e's address space, charging new
+// pages to e's resource group.  If 'share' is an env already loaded
+// from the same binary, read-only segments map share's pages instead
+// of copies.  Pages are filled through their kernel addresses, so
+// this works from any address space.
+//
+// Returns 0 on success, -E_NO_MEM if out of memory.
+//
+static int
+load_segment(struct Env *e, struct Env *share, uint8_t *binary,
+	     struct Proghdr *ph)
+{
+	uintptr_t va, lo, hi, end = ROUNDUP(ph->p_va + ph->p_memsz, PGSIZE);
+	struct PageInfo *pp;
+	int perm = PTE_P | PTE_U, r;
+
+	if (ph->p_flags & ELF_PROG_FLAG_WRITE)
+		perm |= PTE_W;
+	for (va = ROUNDDOWN(ph->p_va, PGSIZE); va < end; va += PGSIZE) {
+		if (share && !(perm & PTE_W)) {
+			pp = page_lookup(share->env_pgdir, (void *) va, NULL);
+			if ((r = page_insert(e->env_pgdir, pp, (void *) va,
+					     perm)) < 0)
+				return r;
+			continue;
+		}
+
+		if (!(pp = rgroup_page_alloc(e, ALLOC_ZERO)))
+			return -E_NO_MEM;
+		if ((r = page_insert(e->env_pgdir, pp, (void *) va, perm)) < 0) {
+			page_free(pp);
+			return r;
+		}
+
+		// Copy the part of the file image that lands on this page;
+		// the rest (bss) stays zero.
+		lo = MAX(va, ph->p_va);
+		hi = MIN(va + PGSIZE, ph->p_va + ph->p_filesz);
+		if (lo < hi)
+			memcpy(page2kva(pp) + (lo - va),
+			       binary + ph->p_offset + (lo - ph->p_va), hi - lo);
+	}
+	return 0;
+}
+
 //
 // Set up the initial program binary, stack, and processor flags
 // for a user process.
@@ -344,18 +591,13 @@ load_icode(struct Env *e, uint8_t *binary)
 	struct Elf* elf_header = (struct Elf*)binary;
 	if (elf_header->e_magic != ELF_MAGIC)
 		panic("load_icode: illegal ELF format.");
-	lcr3(PADDR(e->env_pgdir));
 	struct Proghdr* ph = (struct Proghdr*)((uint8_t*)(elf_header)+elf_header->e_phoff);
 	struct Proghdr* eph = ph + elf_header->e_phnum;
 	for (; ph < eph; ++ph) {
-		if (ph->p_type == ELF_PROG_LOAD) {
-			region_alloc(e, (void*)ph->p_va, ph->p_memsz);
-			memmove((void*)ph->p_pa, binary + ph->p_offset, ph->p_filesz);
-			memset((void*)(ph->p_pa + ph->p_filesz), 0, ph->p_memsz - ph->p_filesz);
-		}
+		if (ph->p_type == ELF_PROG_LOAD && load_segment(e, NULL, binary, ph) < 0)
+			panic("load_icode: out of memory.");
 	}
 	e->env_tf.tf_eip = elf_header->e_entry;
-	lcr3(PADDR(kern_pgdir));
 
 	// Now map one page for the program's initial stack
 	// at virtual address USTACKTOP - PGSIZE.
@@ -370,8 +612,9 @@ load_icode(struct Env *e, uint8_t *binary)
 // This function is ONLY called during kernel initialization,
 // before running the first user-mode environment.
 // The new env's parent ID is set to 0.
+// Returns the new env.
 //
-void
+struct Env *
 env_create(uint8_t *binary, enum EnvType type)
 {
 	// LAB 3: Your code here.
@@ -381,26 +624,313 @@ env_create(uint8_t *binary, enum EnvType type)
 		panic("env_create: %e", r);
 	load_icode(env, binary);
 	env->env_type = type;
+	return env;
 }
 
+// User programs built into the kernel that envs may spawn by name.
+extern uint8_t _binary_obj_user_hello_start[], _binary_obj_user_nop_start[];
+
+static struct {
+	const char *name;
+	uint8_t *binary;
+} env_images[] = {
+	{ "hello", _binary_obj_user_hello_start },
+	{ "nop", _binary_obj_user_nop_start },
+};
+
 //
-// Frees env e and all memory it uses.
+// Return the built-in program image called name (len bytes, not
+// null-terminated), or NULL if there is none.
 //
-void
-env_free(struct Env *e)
+uint8_t *
+env_image(const char *name, size_t len)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(env_images); i++)
+		if (strlen(env_images[i].name) == len
+		    && strncmp(env_images[i].name, name, len) == 0)
+			return env_images[i].binary;
+	return NULL;
+}
+
+//
+// Create up to n runnable children of parent_id, all running the ELF
+// image binary, and store their envids in ids[].  The ELF headers are
+// read once, and every child after the first maps the first child's
+// pages for read-only segments instead of copying them.
+//
+// Returns the number of envs created, which is less than n only if
+// creating the next one failed, or < 0 if none could be created:
+//	-E_INVAL if binary is not an ELF image
+//	-E_NO_FREE_ENV if all NENV environments are allocated
+//	-E_NO_MEM on memory exhaustion
+//
+int
+env_spawn(uint8_t *binary, envid_t parent_id, uint32_t n, envid_t *ids)
+{
+	struct Elf *elf = (struct Elf *) binary;
+	struct Proghdr *ph, *eph;
+	struct Env *e, *first = NULL;
+	struct PageInfo *stack;
+	uint32_t i;
+	int r = 0;
+
+	if (elf->e_magic != ELF_MAGIC)
+		return -E_INVAL;
+	ph = (struct Proghdr *) (binary + elf->e_phoff);
+	eph = ph + elf->e_phnum;
+
+	for (i = 0; i < n; i++) {
+		if ((r = env_alloc(&e, parent_id)) < 0)
+			break;
+		for (ph = eph - elf->e_phnum; ph < eph; ph++)
+			if (ph->p_type == ELF_PROG_LOAD
+			    && (r = load_segment(e, first, binary, ph)) < 0)
+				break;
+		if (r == 0 && !(stack = rgroup_page_alloc(e, 0)))
+			r = -E_NO_MEM;
+		if (r == 0 && (r = page_insert(e->env_pgdir, stack,
+			(void *) (USTACKTOP - PGSIZE), PTE_P | PTE_U | PTE_W)) < 0)
+			page_free(stack);
+		if (r < 0) {
+			env_free(e);
+			break;
+		}
+
+		e->env_tf.tf_eip = elf->e_entry;
+		if (!first)
+			first = e;
+		ids[i] = e->env_id;
+	}
+	return i > 0 ? i : r;
+}
+
+//
+// Make e use src's user page tables instead of its own.  Each page
+// table's pp_ref counts the page directories sharing it; the first
+// change through any of them gets that page directory a private copy
+// (see pgtable_unshare in pmap.c).  So that writes come to the kernel,
+// src must map no private writable pages; pages shared with other
+// address spaces may stay writable.  e must have no user mappings yet.
+//
+static void
+env_share_vm(struct Env *e, struct Env *src)
 {
+	uint32_t pdeno;
+
+	for (pdeno = 0; pdeno < PDX(UTOP); pdeno++) {
+		if (!(src->env_pgdir[pdeno] & PTE_P))
+			continue;
+		e->env_pgdir[pdeno] = src->env_pgdir[pdeno];
+		pa2page(PTE_ADDR(src->env_pgdir[pdeno]))->pp_ref++;
+	}
+}
+
+//
+// Capture src as a template: a child env of src that never runs,
+// holding src's registers and a copy-on-write image of src's address
+// space.  src's private writable pages become copy-on-write as well.
+// Writable pages that are already shared, because they are mapped
+// with PTE_SHARE or mapped more than once (by sys_page_map, IPC or a
+// channel), stay shared and writable in both.
+// The template's saved %eax is 0, so envs cloned from a template that
+// sys_env_snapshot() made return 0 from that call.
+//
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_INVAL if src has a system call ring, which must stay shared
+//		with the kernel rather than become copy-on-write
+//	-E_NO_FREE_ENV if all NENV environments are allocated
+//	-E_NO_MEM on memory exhaustion
+//
+int
+env_snapshot(struct Env *src, struct Env **tmpl_store)
+{
+	struct Env *t;
 	pte_t *pt;
 	uint32_t pdeno, pteno;
-	physaddr_t pa;
+	int r;
 
-	// If freeing the current environment, switch to kern_pgdir
-	// before freeing the page directory, just in case the page
-	// gets reused.
-	if (e == curenv)
-		lcr3(PADDR(kern_pgdir));
+	if (env_cold(src)->env_ring)
+		return -E_INVAL;
+	if ((r = env_alloc(&t, src->env_id)) < 0)
+		return r;
+	sched_dequeue(t);
+	t->env_status = ENV_NOT_RUNNABLE;
+	t->env_type = ENV_TYPE_TEMPLATE;
+	t->env_tid = src->env_tid;
+	t->env_tf = src->env_tf;
+	t->env_tf.tf_regs.reg_eax = 0;
+	env_cold(t)->env_pgfault_upcall = env_cold(src)->env_pgfault_upcall;
 
-	// Note the environment's demise.
-	cprintf("[%08x] free env %08x\n", curenv ? curenv->env_id : 0, e->env_id);
+	// Page tables src already shares hold no private writable pages.
+	for (pdeno = 0; pdeno < PDX(UTOP); pdeno++) {
+		if (!(src->env_pgdir[pdeno] & PTE_P))
+			continue;
+		pt = (pte_t *) KADDR(PTE_ADDR(src->env_pgdir[pdeno]));
+		for (pteno = 0; pteno <= PTX(~0); pteno++) {
+			if ((pt[pteno] & (PTE_P | PTE_W | PTE_SHARE))
+			    != (PTE_P | PTE_W)
+			    || pa2page(PTE_ADDR(pt[pteno]))->pp_ref > 1)
+				continue;
+			pt[pteno] = (pt[pteno] & ~PTE_W) | PTE_COW;
+			tlb_invalidate(src->env_pgdir, PGADDR(pdeno, pteno, 0));
+		}
+	}
+	env_share_vm(t, src);
+
+	*tmpl_store = t;
+	return 0;
+}
+
+//
+// Start a new runnable env from template tmpl, with parent parent_id.
+// The new env gets its own page directory and a copy of the template's
+// registers; everything else is shared copy-on-write.  It is the only
+// thread of its address space, and has the thread number of the env
+// the template was taken from.
+//
+// Returns 0 on success, < 0 on error from env_alloc.
+//
+int
+env_clone(struct Env *tmpl, envid_t parent_id, struct Env **newenv_store)
+{
+	struct Env *e;
+	int r;
+
+	assert(tmpl->env_type == ENV_TYPE_TEMPLATE);
+	if ((r = env_alloc(&e, parent_id)) < 0)
+		return r;
+	env_share_vm(e, tmpl);
+	e->env_tf = tmpl->env_tf;
+
+	// The clone carries on as the thread the template was taken from,
+	// on that thread's stacks, so it takes that thread's number.
+	e->env_tid = tmpl->env_tid;
+	e->env_vdata->vd_tids = 1 << e->env_tid;
+	e->env_vdata->vd_threads[0].vt_envid = 0;
+	e->env_vdata->vd_threads[e->env_tid].vt_envid = e->env_id;
+	env_cold(e)->env_pgfault_upcall = env_cold(tmpl)->env_pgfault_upcall;
+
+	*newenv_store = e;
+	return 0;
+}
+
+//
+// Start a new thread in src's address space: a runnable child env of
+// src that shares src's page directory.  A page directory's pp_ref
+// counts the threads using it, and env_free() tears it down only
+// when the last one goes.
+//
+// The thread gets the lowest thread number t not in use in the address
+// space, by the vd_tids bitmap in its VData page, and a fresh stack
+// page in slot t (see UTSTACKSLOT).  It starts
+// at eip as if called from ret with the single argument arg.  If src
+// has a page fault upcall, so does the thread, with an exception
+// stack in slot t as well.
+//
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_NO_FREE_ENV if the address space already has NTHREADS threads,
+//		or all NENV environments are allocated
+//	-E_NO_MEM on memory exhaustion
+//
+int
+env_thread_create(struct Env *src, uintptr_t eip, uint32_t arg,
+		  uintptr_t ret, struct Env **newenv_store)
+{
+	struct VData *vd = src->env_vdata;
+	struct PageInfo *pp;
+	struct Env *e;
+	uint32_t tid, *sp;
+	uintptr_t stacktop;
+	bool xnew = 0;
+	void *xva;
+	int r;
+
+	static_assert(NTHREADS <= 32);
+	for (tid = 0; tid < NTHREADS && (vd->vd_tids & (1 << tid)); tid++)
+		/* do nothing */;
+	if (tid == NTHREADS)
+		return -E_NO_FREE_ENV;
+
+	// A stack left behind by an earlier thread t is replaced.
+	stacktop = USTACKTOP - tid * UTSTACKSLOT;
+	if (!(pp = rgroup_page_alloc(src, ALLOC_ZERO)))
+		return -E_NO_MEM;
+	sp = (uint32_t *) (page2kva(pp) + PGSIZE);
+	*--sp = arg;
+	*--sp = ret;
+	if ((r = page_insert(src->env_pgdir, pp, (void *) (stacktop - PGSIZE),
+			     PTE_P | PTE_U | PTE_W)) < 0) {
+		page_free(pp);
+		return r;
+	}
+
+	// An exception stack left behind by an earlier thread t is kept.
+	xva = (void *) (UTXSTACKTOP(tid) - PGSIZE);
+	if (env_cold(src)->env_pgfault_upcall
+	    && !page_lookup(src->env_pgdir, xva, NULL)) {
+		r = -E_NO_MEM;
+		if (!(pp = rgroup_page_alloc(src, ALLOC_ZERO)))
+			goto fail;
+		if ((r = page_insert(src->env_pgdir, pp, xva,
+				     PTE_P | PTE_U | PTE_W)) < 0) {
+			page_free(pp);
+			goto fail;
+		}
+		xnew = 1;
+	}
+
+	if ((r = env_alloc_in(&e, src->env_id, src->env_pgdir, vd)) < 0)
+		goto fail;
+	pa2page(PADDR(e->env_pgdir))->pp_ref++;
+	e->env_tid = tid;
+	vd->vd_tids |= 1 << tid;
+	vd->vd_threads[tid].vt_envid = e->env_id;
+	e->env_tf = src->env_tf;
+	e->env_tf.tf_eip = eip;
+	e->env_tf.tf_esp = stacktop - 2 * sizeof(uint32_t);
+	env_cold(e)->env_pgfault_upcall = env_cold(src)->env_pgfault_upcall;
+
+	*newenv_store = e;
+	return 0;
+
+fail:
+	if (xnew)
+		page_remove(src->env_pgdir, xva);
+	page_remove(src->env_pgdir, (void *) (stacktop - PGSIZE));
+	return r;
+}
+
+// Give e's thread number back to its address space.
+static void
+env_put_tid(struct Env *e)
+{
+	if (e->env_vdata)
+		e->env_vdata->vd_tids &= ~(1 << e->env_tid);
+}
+
+//
+// Unmap and free all of e's memory, including its page directory.
+// If chunked is set, the caller is a kernel thread, and gives up the
+// CPU after every ENV_REAP_CHUNK pages.  Returns the number of pages
+// unmapped.
+//
+static uint32_t
+env_free_vm(struct Env *e, bool chunked)
+{
+	pte_t *pt;
+	uint32_t pdeno, pteno, npages = 0;
+	physaddr_t pa;
+
+	// Other threads still use the address space
+	pa = PADDR(e->env_pgdir);
+	if (pa2page(pa)->pp_ref > 1) {
+		e->env_pgdir = 0;
+		page_decref(pa2page(pa));
+		return 0;
+	}
+	shm_detach_pgdir(e->env_pgdir);
 
 	// Flush all mapped pages in the user portion of the address space
 	static_assert(UTOP % PTSIZE == 0);
@@ -414,10 +944,21 @@ env_free(struct Env *e)
 		pa = PTE_ADDR(e->env_pgdir[pdeno]);
 		pt = (pte_t*) KADDR(pa);
 
+		// a page table shared with a template or its clones
+		// keeps its pages for the others
+		if (pa2page(pa)->pp_ref > 1) {
+			e->env_pgdir[pdeno] = 0;
+			page_decref(pa2page(pa));
+			continue;
+		}
+
 		// unmap all PTEs in this page table
 		for (pteno = 0; pteno <= PTX(~0); pteno++) {
-			if (pt[pteno] & PTE_P)
-				page_remove(e->env_pgdir, PGADDR(pdeno, pteno, 0));
+			if (!(pt[pteno] & PTE_P))
+				continue;
+			page_remove(e->env_pgdir, PGADDR(pdeno, pteno, 0));
+			if (++npages % ENV_REAP_CHUNK == 0 && chunked)
+				kthread_yield();
 		}
 
 		// free the page table itself
@@ -426,30 +967,142 @@ env_free(struct Env *e)
 	}
 
 	// free the page directory
-	pa = PADDR(e->env_pgdir);
+	env_free_pgdir(e->env_pgdir);
 	e->env_pgdir = 0;
-	page_decref(pa2page(pa));
+	return npages;
+}
+
+//
+// Frees env e and all memory it uses.
+//
+void
+env_free(struct Env *e)
+{
+	// Kernel threads share kern_pgdir and are never freed.
+	assert(e->env_type != ENV_TYPE_KTHREAD);
+
+	// If freeing the current environment, switch to kern_pgdir
+	// before freeing the page directory, just in case the page
+	// gets reused.
+	if (e == curenv)
+		tlb_switch(kern_pgdir);
+
+	// Note the environment's demise.
+	cprintf("[%08x] free env %08x\n", curenv ? curenv->env_id : 0, e->env_id);
+
+	rgroup_leave(e);
+	sched_rt_remove(e);
+	uring_free(e);
+	futex_cancel(e);
+	env_put_tid(e);
+	env_reap_stats.rs_pages += env_free_vm(e, 0);
 
 	// return the environment to the free list
+	if (e->env_rq >= 0)
+		sched_dequeue(e);
 	e->env_status = ENV_FREE;
 	e->env_link = env_free_list;
 	env_free_list = e;
 }
 
+// Free the memory of e, which env_reclaim() took out of service, and
+// put e back on the free list.
+static void
+env_reap_now(struct Env *e, bool chunked)
+{
+	uint64_t start = read_tsc();
+
+	env_reap_stats.rs_pages += env_free_vm(e, chunked);
+	env_reap_stats.rs_reclaim_cycles += read_tsc() - start;
+
+	e->env_status = ENV_FREE;
+	e->env_link = env_free_list;
+	env_free_list = e;
+}
+
+// Work item that frees a dead env's memory in the background.
+static void
+env_reap(void *arg)
+{
+	env_reap_now(arg, 1);
+}
+
+//
+// Take e, which no CPU is running any more, out of service at once and
+// hand the freeing of its memory to the work queue.  e stays ENV_DYING,
+// which envid2env() rejects, until env_reap() puts it back on the free
+// list.
+//
+void
+env_reclaim(struct Env *e)
+{
+	// Note the environment's demise.
+	cprintf("[%08x] free env %08x\n", curenv ? curenv->env_id : 0, e->env_id);
+
+	if (e == curenv) {
+		tlb_switch(kern_pgdir);
+		this_cpu_write(cpu_env, NULL);
+	}
+	if (e->env_rq >= 0)
+		sched_dequeue(e);
+	e->env_status = ENV_DYING;
+	rgroup_leave(e);
+	sched_rt_remove(e);
+	uring_free(e);
+	futex_cancel(e);
+	env_put_tid(e);
+	env_reap_stats.rs_envs++;
+
+	// If the queue is full, free it on the spot.
+	if (queue_work(env_reap, e) < 0)
+		env_reap_now(e, 0);
+}
+
 //
 // Frees environment e.
+// If e was the current env, then runs a new environment (and does not
+// return to the caller).
 //
 void
 env_destroy(struct Env *e)
 {
-	env_free(e);
+	uint64_t start = read_tsc(), cycles;
+	bool self = (e == curenv);
+
+	// If e is currently running on other CPUs, we change its state to
+	// ENV_DYING. A zombie environment will be reclaimed the next time
+	// it traps to the kernel.
+	if (e->env_status == ENV_RUNNING && curenv != e) {
+		e->env_status = ENV_DYING;
+		return;
+	}
+
+	env_reclaim(e);
 
-	cprintf("Destroyed the only environment - nothing more to do!\n");
-	while (1)
-		monitor(NULL);
+	// This is all the time the caller (or the trap that killed e)
+	// waits for; the memory is freed later.
+	cycles = read_tsc() - start;
+	env_reap_stats.rs_destroy_cycles += cycles;
+	if (cycles > env_reap_stats.rs_destroy_max)
+		env_reap_stats.rs_destroy_max = cycles;
+
+	if (self) {
+		this_cpu_write(cpu_swreason, SW_EXIT);
+		sched_yield();
+	}
 }
 
 
+// Charge e for the time the kernel has spent on its behalf since this
+// CPU last entered or left user mode.
+static void
+env_charge_stime(struct Env *e, uint64_t now)
+{
+	e->env_stats.es_stime += now - thiscpu->cpu_tsc;
+	rgroup_charge(e, now - thiscpu->cpu_tsc);
+	sched_rt_charge(e, now - thiscpu->cpu_tsc);
+}
+
 //
 // Restores the register values in the Trapframe with the 'iret' instruction.
 // This exits the kernel and starts executing some environment's code.
@@ -497,12 +1150,77 @@ env_run(struct Env *e)
 	//	e->env_tf to sensible values.
 
 	// LAB 3: Your code here.
-	if (curenv && curenv->env_status == ENV_RUNNING)
+	struct Env *prev = curenv;
+	uint64_t now;
+
+	if (curenv != e && curenv && curenv->env_status == ENV_RUNNING) {
 		curenv->env_status = ENV_RUNNABLE;
-	curenv = e;
+		sched_enqueue(curenv);
+	}
+	// e may be queued even if it is curenv, when sched_yield() put it
+	// back on the queue before choosing it again.
+	if (e->env_rq >= 0)
+		sched_dequeue(e);
+	if (e->env_status == ENV_RUNNABLE)
+		sched_note_wait(e, read_tsc());
+	this_cpu_write(cpu_env, e);
 	curenv->env_status = ENV_RUNNING;
+	curenv->env_cpunum = thiscpu->cpu_id;
+	if (curenv->env_vdata)
+		curenv->env_vdata->vd_threads[curenv->env_tid].vt_cpu =
+			curenv->env_cpunum;
 	++curenv->env_runs;
-	lcr3(PADDR(curenv->env_pgdir));
+	// Switching between threads of one env, or back to the same env,
+	// keeps the loaded page directory.  prev is live, so its page
+	// directory cannot have been freed and reused.
+	if (!prev || prev->env_pgdir != e->env_pgdir
+	    || this_cpu_read(cpu_pgdir) != e->env_pgdir)
+		tlb_switch(e->env_pgdir);
+	tlb_flush();
+
+	// The kernel has been working for the env that trapped since
+	// then (or for the kernel thread we are leaving).
+	now = read_tsc();
+	if (prev)
+		env_charge_stime(prev, now);
+	thiscpu->cpu_tsc = now;
+
+	// Kernel threads run holding the big kernel lock.
+	if (curenv->env_type == ENV_TYPE_KTHREAD)
+		kthread_resume(curenv->env_kesp);
+
+	// The next trap from user mode builds its frame in env_tf.
+	thiscpu->cpu_ts.ts_esp0 = (uintptr_t) (&curenv->env_tf + 1);
+	unlock_kernel();
+	env_pop_tf(&curenv->env_tf);
+}
+
+//
+// Finish in the kernel for curenv, which trapped and is going back to
+// user mode without a switch: send queued TLB shootdowns, charge
+// curenv for the kernel time and release the big kernel lock.
+//
+void
+env_leave_kernel(void)
+{
+	uint64_t now = read_tsc();
+
+	tlb_flush();
+	env_charge_stime(curenv, now);
+	thiscpu->cpu_tsc = now;
+	unlock_kernel();
+}
+
+//
+// Return to curenv, still running, from its trap.  Its registers are
+// in env_tf and its address space is already loaded, so this skips
+// everything env_run() does to switch.
+// This function does not return.
+//
+void
+env_resume(void)
+{
+	env_leave_kernel();
 	env_pop_tf(&curenv->env_tf);
 }
 
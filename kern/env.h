@@ -4,21 +4,82 @@
 #define JOS_KERN_ENV_H
 
 #include <inc/env.h>
+#include <kern/cpu.h>
 
 extern struct Env *envs;		// All environments
-extern struct Env *curenv;		// Current environment
+extern uint32_t nenvs;			// Length of the mapped part of envs[]
+#define curenv this_cpu_read(cpu_env)		// Current environment
 extern struct Segdesc gdt[];
 
+// Whether e is still some CPU's current env.  That holds from env_run()
+// until the CPU switches away from e, whatever e's env_status says.
+static inline bool
+env_on_cpu(struct Env *e)
+{
+	return e->env_cpunum >= 0 && cpus[e->env_cpunum].cpu_env == e;
+}
+
+// Kernel-only env state that nothing reads on a context switch or a scan
+// of envs[].  It lives in pages of its own, allocated as envs[] grows, so
+// that it neither widens the user-visible envs[] nor dilutes the lines
+// the scheduler walks.
+struct EnvCold {
+	uint64_t env_futex_deadline;	// TSC deadline of the wait, or 0
+	struct PageInfo *env_ring;	// Registered uring page, or NULL
+	void *env_ipc_dstva;		// VA at which to map received page
+	void *env_pgfault_upcall;	// Page fault upcall entry point
+	physaddr_t env_futex;		// Futex key waited on, or 0
+	struct Env *env_futex_next;	// Next env in the futex bucket
+	bool env_ipc_recving;		// Env is blocked receiving
+};
+
+#define ENV_COLD_PER_PAGE	(PGSIZE / sizeof(struct EnvCold))
+
+extern struct EnvCold *env_cold_pages[];
+
+static inline struct EnvCold *
+env_cold(struct Env *e)
+{
+	uint32_t i = e - envs;
+
+	return &env_cold_pages[i / ENV_COLD_PER_PAGE][i % ENV_COLD_PER_PAGE];
+}
+
 void	env_init(void);
 void	env_init_percpu(void);
 int	env_alloc(struct Env **e, envid_t parent_id);
+int	env_alloc_in(struct Env **e, envid_t parent_id, pde_t *pgdir,
+		     struct VData *vdata);
 void	env_free(struct Env *e);
-void	env_create(uint8_t *binary, enum EnvType type);
+struct Env *env_create(uint8_t *binary, enum EnvType type);
+uint8_t *env_image(const char *name, size_t len);
+int	env_spawn(uint8_t *binary, envid_t parent_id, uint32_t n,
+		  envid_t *ids);
+int	env_snapshot(struct Env *src, struct Env **tmpl_store);
+int	env_clone(struct Env *tmpl, envid_t parent_id, struct Env **newenv_store);
+int	env_thread_create(struct Env *src, uintptr_t eip, uint32_t arg,
+			  uintptr_t ret, struct Env **newenv_store);
+void	env_reclaim(struct Env *e);
 void	env_destroy(struct Env *e);	// Does not return if e == curenv
 
+#define ENV_REAP_CHUNK	256	// pages freed between reaper yields
+
+// Teardown costs, reported by the 'reap' monitor command.
+struct EnvReapStats {
+	uint32_t rs_envs;		// Envs destroyed
+	uint32_t rs_pages;		// User pages they had mapped
+	uint64_t rs_destroy_cycles;	// Total time env_destroy() took
+	uint64_t rs_destroy_max;	// Longest env_destroy()
+	uint64_t rs_reclaim_cycles;	// Total time spent freeing memory
+};
+
+extern struct EnvReapStats env_reap_stats;
+
 int	envid2env(envid_t envid, struct Env **env_store, bool checkperm);
-// The following two functions do not return
+void	env_leave_kernel(void);
+// The following three functions do not return
 void	env_run(struct Env *e) __attribute__((noreturn));
+void	env_resume(void) __attribute__((noreturn));
 void	env_pop_tf(struct Trapframe *tf) __attribute__((noreturn));
 
 // Without this extra macro, we couldn't pass macros like TEST to
@@ -0,0 +1,194 @@
+// Futexes: waiting for a word of user memory to change.
+//
+// A futex is named by the physical address of the word, so envs that
+// share the page through different virtual addresses share the futex.
+// Waiting envs hang off a hashed table of singly linked lists through
+// their EnvCold's env_futex_next.  The big kernel lock serializes
+// futex_wait against futex_wake, so a wait cannot miss a wake that
+// follows the change it checks for.
+//
+// A wait with a timeout also has a deadline, which the timer interrupt
+// checks (see futex_expire), so timeouts are good to a timer tick.
+
+#include <inc/error.h>
+#include <inc/mmu.h>
+#include <inc/x86.h>
+
+#include <kern/futex.h>
+#include <kern/env.h>
+#include <kern/pmap.h>
+#include <kern/sched.h>
+#include <kern/kclock.h>
+
+static struct Env *futex_hash[FUTEX_NHASH];
+static uint32_t futex_ntimed;		// Waiters with a deadline
+
+static struct Env **
+futex_bucket(physaddr_t key)
+{
+	return &futex_hash[((key >> 2) * 0x9e3779b1) >> (32 - FUTEX_HASHBITS)];
+}
+
+// Find the physical address of the word at addr in e's address space.
+// A copy-on-write page is copied first: the first write to it, which
+// a waker's usually is, would move the word to another page and so to
+// another futex.
+//
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_INVAL if addr >= UTOP, is not 4-byte aligned, or is not mapped
+//		user-accessible in e's address space.
+//	-E_NO_MEM if there is no memory to copy a copy-on-write page.
+static int
+futex_key(struct Env *e, uint32_t *addr, physaddr_t *key_store)
+{
+	struct PageInfo *pp;
+	pte_t *pte;
+	int r;
+
+	if ((uintptr_t) addr >= UTOP || (uintptr_t) addr % 4)
+		return -E_INVAL;
+	if (!(pp = page_lookup(e->env_pgdir, addr, &pte))
+	    || !(*pte & PTE_U))
+		return -E_INVAL;
+	if (*pte & PTE_COW) {
+		if ((r = page_cow(e, addr)) < 0)
+			return r;
+		pp = page_lookup(e->env_pgdir, addr, NULL);
+	}
+	*key_store = page2pa(pp) | PGOFF(addr);
+	return 0;
+}
+
+// Unlink the waiter at *pe from its bucket.
+static struct Env *
+futex_unlink(struct Env **pe)
+{
+	struct Env *e = *pe;
+	struct EnvCold *c = env_cold(e);
+
+	*pe = c->env_futex_next;
+	c->env_futex = 0;
+	if (c->env_futex_deadline) {
+		c->env_futex_deadline = 0;
+		futex_ntimed--;
+	}
+	return e;
+}
+
+// Make w, just taken out of the table, runnable with system call
+// result r.  Whatever else makes a waiter runnable takes it out of the
+// table first (see futex_cancel), so w should still be blocked in
+// futex_wait; this only double-checks that it is not blocked in
+// anything else.  Returns whether it was still waiting.
+static bool
+futex_resume(struct Env *w, int r)
+{
+	if (w->env_status != ENV_NOT_RUNNABLE
+	    || env_cold(w)->env_ipc_recving)
+		return 0;
+	w->env_tf.tf_regs.reg_eax = r;
+	w->env_status = ENV_RUNNABLE;
+	sched_enqueue(w);
+	return 1;
+}
+
+// Take e out of the wait table if it is there.  Anything that ends
+// e's wait other than a wake or a timeout must call this.
+void
+futex_cancel(struct Env *e)
+{
+	physaddr_t key = env_cold(e)->env_futex;
+	struct Env **pe;
+
+	if (!key)
+		return;
+	for (pe = futex_bucket(key); *pe; pe = &env_cold(*pe)->env_futex_next)
+		if (*pe == e) {
+			futex_unlink(pe);
+			break;
+		}
+}
+
+//
+// Block e, which must be curenv, on the futex at addr if the word
+// there still holds val.  The caller should then give up the CPU; e
+// runs again, with 0 as its system call result, once woken, or with
+// -E_TIMEOUT if timeout is nonzero and that many microseconds pass
+// first.
+//
+// Returns 0 if e is now waiting, < 0 on error.  Errors are:
+//	-E_AGAIN if the word at addr does not hold val.
+//	Any error from futex_key.
+//
+int
+futex_wait(struct Env *e, uint32_t *addr, uint32_t val, uint32_t timeout)
+{
+	struct EnvCold *c;
+	struct Env **b;
+	physaddr_t key;
+	int r;
+
+	if ((r = futex_key(e, addr, &key)) < 0)
+		return r;
+	if (*(uint32_t *) KADDR(key) != val)
+		return -E_AGAIN;
+
+	b = futex_bucket(key);
+	c = env_cold(e);
+	c->env_futex = key;
+	c->env_futex_next = *b;
+	*b = e;
+	if (timeout) {
+		c->env_futex_deadline =
+			read_tsc() + (uint64_t) timeout * tsc_khz / 1000;
+		futex_ntimed++;
+	}
+	e->env_status = ENV_NOT_RUNNABLE;
+	return 0;
+}
+
+//
+// Wake up to n envs waiting on the futex at addr in e's address space.
+//
+// Returns the number of envs woken, or < 0 on error from futex_key.
+//
+int
+futex_wake(struct Env *e, uint32_t *addr, uint32_t n)
+{
+	struct Env **pe;
+	physaddr_t key;
+	uint32_t woken = 0;
+	int r;
+
+	if ((r = futex_key(e, addr, &key)) < 0)
+		return r;
+	pe = futex_bucket(key);
+	while (*pe && woken < n) {
+		if (env_cold(*pe)->env_futex != key)
+			pe = &env_cold(*pe)->env_futex_next;
+		else if (futex_resume(futex_unlink(pe), 0))
+			woken++;
+	}
+	return woken;
+}
+
+//
+// Time out the waits whose deadlines have passed.  Called on every
+// timer interrupt.
+//
+void
+futex_expire(uint64_t now)
+{
+	struct EnvCold *c;
+	struct Env **pe;
+	int i;
+
+	for (i = 0; futex_ntimed && i < FUTEX_NHASH; i++)
+		for (pe = &futex_hash[i]; *pe; ) {
+			c = env_cold(*pe);
+			if (c->env_futex_deadline && now >= c->env_futex_deadline)
+				futex_resume(futex_unlink(pe), -E_TIMEOUT);
+			else
+				pe = &c->env_futex_next;
+		}
+}
@@ -0,0 +1,22 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_FUTEX_H
+#define JOS_KERN_FUTEX_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+
+struct Env;
+
+#define FUTEX_HASHBITS	6
+#define FUTEX_NHASH	(1 << FUTEX_HASHBITS)	// Wait table buckets
+
+int	futex_wait(struct Env *e, uint32_t *addr, uint32_t val,
+		   uint32_t timeout);
+int	futex_wake(struct Env *e, uint32_t *addr, uint32_t n);
+void	futex_cancel(struct Env *e);
+void	futex_expire(uint64_t now);
+
+#endif	// !JOS_KERN_FUTEX_H
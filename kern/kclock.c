@@ -1,11 +1,15 @@
 /* See COPYRIGHT for copyright information. */
 
-/* Support for reading the NVRAM from the real-time clock. */
+/* Support for reading the NVRAM from the real-time clock, and for
+ * timing the TSC against the programmable interval timer. */
 
 #include <inc/x86.h>
+#include <inc/stdio.h>
 
 #include <kern/kclock.h>
 
+uint64_t tsc_boot;
+uint32_t tsc_khz;
 
 unsigned
 mc146818_read(unsigned reg)
@@ -20,3 +24,24 @@ mc146818_write(unsigned reg, unsigned datum)
 	outb(IO_RTC, reg);
 	outb(IO_RTC+1, datum);
 }
+
+/* Count TSC cycles while PIT channel 2 counts down 10 ms, in mode 0
+ * (interrupt on terminal count) with the speaker off, and start the
+ * clock that user programs read (see inc/vdata.h). */
+void
+tsc_calibrate(void)
+{
+	uint32_t count = PIT_HZ / 100;
+	uint64_t start;
+
+	outb(IO_PIT_GATE, (inb(IO_PIT_GATE) & ~0x02) | 0x01);
+	outb(IO_PIT+3, 0xb0);		/* channel 2, lobyte/hibyte, mode 0 */
+	outb(IO_PIT+2, count & 0xff);
+	outb(IO_PIT+2, count >> 8);
+	start = read_tsc();
+	while (!(inb(IO_PIT_GATE) & 0x20))
+		/* do nothing */;
+	tsc_khz = (uint32_t) (read_tsc() - start) / 10;
+	tsc_boot = read_tsc();
+	cprintf("TSC: %u kHz\n", tsc_khz);
+}
@@ -23,7 +23,15 @@
 #define NVRAM_EXT16LO	(MC_NVRAM_START + 38)	/* low byte; RTC off. 0x34 */
 #define NVRAM_EXT16HI	(MC_NVRAM_START + 39)	/* high byte; RTC off. 0x35 */
 
+#define	IO_PIT		0x040		/* 8253/8254 timer ports */
+#define	IO_PIT_GATE	0x061		/* Channel 2 gate and output */
+#define	PIT_HZ		1193182
+
+extern uint64_t tsc_boot;		/* TSC at tsc_calibrate() */
+extern uint32_t tsc_khz;		/* TSC cycles per millisecond */
+
 unsigned mc146818_read(unsigned reg);
 void mc146818_write(unsigned reg, unsigned datum);
+void tsc_calibrate(void);
 
 #endif	// !JOS_KERN_KCLOCK_H
@@ -0,0 +1,183 @@
+// Kernel threads and the deferred work queue.
+//
+// A kernel thread is an Env of type ENV_TYPE_KTHREAD.  The scheduler
+// queues and picks it like any other env, but env_run() resumes it in
+// ring 0 on kern_pgdir and its own stack instead of popping a user
+// trapframe.  Like all other kernel code, a kernel thread runs with
+// interrupts disabled and the big kernel lock held, so it must give up
+// the CPU by itself: kthread_yield() to go to the back of its run
+// queue, or kthread_sleep() to wait for kthread_wakeup().
+//
+// A kernel thread's saved stack pointer lives in env_kesp; env_tf is
+// unused except to pass the start function.
+
+#include <inc/x86.h>
+#include <inc/error.h>
+#include <inc/assert.h>
+
+#include <kern/kthread.h>
+#include <kern/env.h>
+#include <kern/pmap.h>
+#include <kern/sched.h>
+
+void kthread_switch(uint32_t *esp_store, uint32_t esp, void (*fn)(void));
+
+// The first code a new kernel thread runs.
+static void
+kthread_main(void)
+{
+	void (*fn)(void *) = (void (*)(void *)) curenv->env_tf.tf_eip;
+
+	fn((void *) curenv->env_tf.tf_regs.reg_eax);
+	panic("kthread %08x returned", curenv->env_id);
+}
+
+//
+// Create a runnable kernel thread that calls fn(arg), which must never
+// return.
+//
+// Returns 0 on success, < 0 on failure.  Errors include:
+//	-E_NO_FREE_ENV if all NENV environments are allocated
+//	-E_NO_MEM on memory exhaustion
+//
+int
+kthread_create(struct Env **store, void (*fn)(void *), void *arg)
+{
+	struct PageInfo *stack;
+	struct Env *e;
+	uint32_t *sp;
+	int r;
+
+	if (!(stack = page_alloc(ALLOC_ZERO)))
+		return -E_NO_MEM;
+	// Kernel threads run on the kernel's own page directory.
+	if ((r = env_alloc_in(&e, 0, kern_pgdir, NULL)) < 0) {
+		page_free(stack);
+		return r;
+	}
+	stack->pp_ref++;
+
+	e->env_type = ENV_TYPE_KTHREAD;
+	e->env_tf.tf_eip = (uintptr_t) fn;
+	e->env_tf.tf_regs.reg_eax = (uint32_t) arg;
+
+	// Build the frame kthread_resume expects: the callee-saved
+	// registers, then a return address into kthread_main.
+	sp = (uint32_t *) ((char *) page2kva(stack) + KTHREAD_STKSIZE);
+	*--sp = 0;			// kthread_main's return address
+	*--sp = (uint32_t) kthread_main;
+	sp -= 4;			// edi, esi, ebx, ebp
+	e->env_kesp = (uint32_t) sp;
+
+	*store = e;
+	return 0;
+}
+
+//
+// Give up the CPU, staying runnable.  Returns when the scheduler next
+// picks this kernel thread, possibly on another CPU.
+//
+void
+kthread_yield(void)
+{
+	struct Env *e = curenv;
+
+	assert(e && e->env_type == ENV_TYPE_KTHREAD);
+	// Leave our own stack before scheduling: another CPU may resume
+	// us on it as soon as the big kernel lock is released.
+	kthread_switch(&e->env_kesp, KSTACKTOP_CPU(thiscpu->cpu_id),
+		       sched_yield);
+}
+
+// Give up the CPU until kthread_wakeup() is called on this thread.
+void
+kthread_sleep(void)
+{
+	curenv->env_status = ENV_NOT_RUNNABLE;
+	kthread_yield();
+}
+
+void
+kthread_wakeup(struct Env *e)
+{
+	if (e->env_status == ENV_NOT_RUNNABLE) {
+		e->env_status = ENV_RUNNABLE;
+		sched_enqueue(e);
+	}
+}
+
+
+//
+// Deferred work.
+// Work items run in FIFO order on a single worker thread.  Like the rest
+// of the kernel's state, the queue is protected by the big kernel lock.
+//
+
+struct WorkqStats workq_stats;
+
+static struct Work {
+	void (*fn)(void *);
+	void *arg;
+	uint64_t queued;		// TSC when queued
+} workq[WORKQ_SIZE];
+static uint32_t workq_head, workq_tail;
+static struct Env *worker;
+
+static void
+worker_main(void *unused)
+{
+	struct Work w;
+	uint64_t wait;
+	int n;
+
+	while (1) {
+		for (n = 0; n < WORKQ_BATCH && workq_head != workq_tail; n++) {
+			w = workq[workq_head++ % WORKQ_SIZE];
+			wait = read_tsc() - w.queued;
+			workq_stats.ws_done++;
+			workq_stats.ws_wait_total += wait;
+			if (wait > workq_stats.ws_wait_max)
+				workq_stats.ws_wait_max = wait;
+			w.fn(w.arg);
+		}
+
+		// Let envs run between batches.
+		if (workq_head == workq_tail)
+			kthread_sleep();
+		else
+			kthread_yield();
+	}
+}
+
+void
+workq_init(void)
+{
+	int r;
+
+	static_assert((WORKQ_SIZE & (WORKQ_SIZE - 1)) == 0);
+	if ((r = kthread_create(&worker, worker_main, NULL)) < 0)
+		panic("workq_init: %e", r);
+}
+
+//
+// Arrange for fn(arg) to be called later from the worker thread.
+// fn runs in the kernel on kern_pgdir, with no current user env.
+//
+// Returns 0 on success, -E_NO_MEM if the queue is full.
+//
+int
+queue_work(void (*fn)(void *), void *arg)
+{
+	struct Work *w;
+
+	if (workq_tail - workq_head == WORKQ_SIZE) {
+		workq_stats.ws_full++;
+		return -E_NO_MEM;
+	}
+	w = &workq[workq_tail++ % WORKQ_SIZE];
+	w->fn = fn;
+	w->arg = arg;
+	w->queued = read_tsc();
+	kthread_wakeup(worker);
+	return 0;
+}
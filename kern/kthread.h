@@ -0,0 +1,36 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_KTHREAD_H
+#define JOS_KERN_KTHREAD_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+
+struct Env;
+
+#define KTHREAD_STKSIZE	PGSIZE	// size of a kernel thread's stack
+#define WORKQ_SIZE	64	// work items that may be pending at once
+#define WORKQ_BATCH	8	// items the worker runs before yielding
+
+// Work queue latency, from queue_work() until the item starts running.
+struct WorkqStats {
+	uint32_t ws_done;		// Items run
+	uint32_t ws_full;		// queue_work() calls refused
+	uint64_t ws_wait_total;		// Total cycles items waited
+	uint64_t ws_wait_max;		// Longest wait, in cycles
+};
+
+extern struct WorkqStats workq_stats;
+
+int	kthread_create(struct Env **store, void (*fn)(void *), void *arg);
+void	kthread_yield(void);
+void	kthread_sleep(void);
+void	kthread_wakeup(struct Env *e);
+void	kthread_resume(uint32_t esp) __attribute__((noreturn));
+
+void	workq_init(void);
+int	queue_work(void (*fn)(void *), void *arg);
+
+#endif	// !JOS_KERN_KTHREAD_H
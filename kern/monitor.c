@@ -11,6 +11,12 @@
 #include <kern/monitor.h>
 #include <kern/kdebug.h>
 #include <kern/trap.h>
+#include <kern/sched.h>
+#include <kern/tlb.h>
+#include <kern/kthread.h>
+#include <kern/env.h>
+#include <kern/rgroup.h>
+#include <kern/shm.h>
 
 #define CMDBUF_SIZE	80	// enough for one VGA text line
 
@@ -28,6 +34,19 @@ static struct Command commands[] = {
 	{ "traceback", "traceback info", mon_backtrace },
 	{ "showmappings", "Show physical page mappings", mon_showmappings },
 	{ "memdump", "Dump memory contents", mon_memdump },
+	{ "runq", "Show per-CPU run queue statistics", mon_runq },
+	{ "percpu", "Time per-CPU data accessors", mon_percpu },
+	{ "tlb", "Show TLB shootdown statistics", mon_tlb },
+	{ "workq", "Show deferred work queue latency", mon_workq },
+	{ "reap", "Show env teardown latency", mon_reap },
+	{ "envscan", "Time walks over the env table", mon_envscan },
+	{ "spawnbench", "Time env_create against env_clone", mon_spawnbench },
+	{ "ps", "List envs' CPU time and traps [envid for detail]", mon_ps },
+	{ "rgroups", "Show resource group usage", mon_rgroups },
+	{ "rt", "Show real-time envs and deadline misses", mon_rt },
+	{ "schedlat", "Show run queue wait times [envid | trace on|off]",
+	  mon_schedlat },
+	{ "shm", "List shared-memory segments", mon_shm },
 };
 
 /***** Implementations of basic kernel monitor commands *****/
@@ -160,6 +179,399 @@ mon_memdump(int argc, char** argv, struct Trapframe* tf) {
 }
 
 
+int
+mon_runq(int argc, char** argv, struct Trapframe* tf) {
+	uint32_t migrations = 0;
+
+	cprintf("cpu  queued  steals   pulls   ticks  handoffs  misses\n");
+	for (int i = 0; i < ncpu; i++) {
+		struct RunQueue *rq = &runqueues[i];
+		cprintf("%3d  %6u  %6u  %6u  %6u  %8u  %6u\n", i, rq->rq_len,
+			rq->rq_steals, rq->rq_pulls, rq->rq_ticks,
+			rq->rq_handoffs, rq->rq_handoff_misses);
+		migrations += rq->rq_steals + rq->rq_pulls;
+	}
+	cprintf("%u migrations (steal min %d, balance every %d ticks "
+		"at imbalance %d)\n", migrations, SCHED_STEAL_MIN,
+		SCHED_BALANCE_TICKS, SCHED_IMBALANCE);
+	return 0;
+}
+
+
+#define PERCPU_ITERS 10000
+
+// Time the per-CPU accesses trap() makes on every entry (find curenv,
+// bump the trap counter) through %gs and through cpus[cpunum()].
+int
+mon_percpu(int argc, char** argv, struct Trapframe* tf) {
+	struct Env *volatile sink;
+	uint32_t gs_cycles, lapic_cycles;
+	uint64_t start;
+	int i;
+
+	start = read_tsc();
+	for (i = 0; i < PERCPU_ITERS; i++) {
+		sink = this_cpu_read(cpu_env);
+		this_cpu_inc(cpu_ntraps);
+	}
+	gs_cycles = read_tsc() - start;
+
+	start = read_tsc();
+	for (i = 0; i < PERCPU_ITERS; i++) {
+		sink = cpus[cpunum()].cpu_env;
+		cpus[cpunum()].cpu_ntraps++;
+	}
+	lapic_cycles = read_tsc() - start;
+	(void) sink;
+
+	cprintf("%d iterations on CPU %d\n", PERCPU_ITERS, thiscpu->cpu_id);
+	cprintf("  %%gs segment:    %u cycles/iter\n", gs_cycles / PERCPU_ITERS);
+	cprintf("  cpunum() lookup: %u cycles/iter\n",
+		lapic_cycles / PERCPU_ITERS);
+	cprintf("cpu   traps\n");
+	for (i = 0; i < ncpu; i++)
+		cprintf("%3d  %6u\n", i, cpus[i].cpu_ntraps);
+	return 0;
+}
+
+
+int
+mon_tlb(int argc, char** argv, struct Trapframe* tf) {
+	struct TlbStats *ts = &tlb_stats;
+	uint32_t per100 = 0;
+
+	if (ts->ts_invalidations)
+		per100 = ts->ts_ipis * 100 / ts->ts_invalidations;
+	cprintf("%u invalidations, %u seen by other CPUs\n",
+		ts->ts_invalidations, ts->ts_queued);
+	cprintf("%u batches (%u full flushes, batch max %d), %u IPIs\n",
+		ts->ts_batches, ts->ts_full, TLB_BATCH_MAX, ts->ts_ipis);
+	cprintf("%u.%02u IPIs per unmapped page\n", per100 / 100, per100 % 100);
+	return 0;
+}
+
+
+int
+mon_workq(int argc, char** argv, struct Trapframe* tf) {
+	struct WorkqStats *ws = &workq_stats;
+
+	cprintf("%u work items run, %u refused (queue size %d)\n",
+		ws->ws_done, ws->ws_full, WORKQ_SIZE);
+	if (ws->ws_done)
+		cprintf("queue latency: avg %llu cycles, max %llu cycles\n",
+			ws->ws_wait_total / ws->ws_done, ws->ws_wait_max);
+	return 0;
+}
+
+
+int
+mon_reap(int argc, char** argv, struct Trapframe* tf) {
+	struct EnvReapStats *rs = &env_reap_stats;
+
+	cprintf("%u envs destroyed, %u pages reclaimed (%d per chunk)\n",
+		rs->rs_envs, rs->rs_pages, ENV_REAP_CHUNK);
+	if (rs->rs_envs)
+		cprintf("env_destroy: avg %llu cycles, max %llu cycles; "
+			"reclaim: avg %llu cycles\n",
+			rs->rs_destroy_cycles / rs->rs_envs, rs->rs_destroy_max,
+			rs->rs_reclaim_cycles / rs->rs_envs);
+	return 0;
+}
+
+
+// Cycles per env to read the words at offs[0..n) of each of nenvs
+// entries 'stride' bytes apart, starting at envs.  mon_envscan uses
+// it to replay the same walk over the original packed struct Env.
+static uint32_t
+envscan_time(uint32_t stride, const uint32_t *offs, int n)
+{
+	volatile uint32_t sink = 0;
+	uint64_t start;
+	uint32_t i;
+	int j;
+
+	start = read_tsc();
+	for (i = 0; i < nenvs; i++)
+		for (j = 0; j < n; j++)
+			sink += *(volatile uint32_t *)
+				((char *) envs + i * stride + offs[j]);
+	return (read_tsc() - start) / nenvs;
+}
+
+// Time the two ways the kernel walks envs[]: a status scan like
+// sched_halt()'s, and reading the fields env_run() and the run queues
+// use on a switch, for every env in turn.  Each walk runs twice: once
+// over the original 96-byte struct Env, with the fields it had at the
+// offsets it had them, and once over the current layout.
+int
+mon_envscan(int argc, char** argv, struct Trapframe* tf) {
+	// The original struct Env: env_tf, then link, id, parent id, type,
+	// status and runs, then env_pgdir; 96 bytes, packed.
+	static const uint32_t old_scan[] = { 84 };
+	static const uint32_t old_sw[] = {
+		84, 88, 92,
+		offsetof(struct Trapframe, tf_eip),
+		offsetof(struct Trapframe, tf_esp),
+	};
+	static const uint32_t new_scan[] = {
+		offsetof(struct Env, env_status),
+	};
+	static const uint32_t new_sw[] = {
+		offsetof(struct Env, env_status),
+		offsetof(struct Env, env_runs),
+		offsetof(struct Env, env_pgdir),
+		offsetof(struct Env, env_cpunum),
+		offsetof(struct Env, env_rq_next),
+		offsetof(struct Env, env_tf.tf_eip),
+		offsetof(struct Env, env_tf.tf_esp),
+	};
+	uint32_t i, runnable = 0;
+
+	if (!nenvs) {
+		cprintf("envs[] is empty\n");
+		return 0;
+	}
+	for (i = 0; i < nenvs; i++)
+		if (envs[i].env_status == ENV_RUNNABLE)
+			runnable++;
+
+	cprintf("struct Env: %u bytes, switch fields at bytes %u-%u; "
+		"was 96 bytes, unaligned\n", sizeof(struct Env),
+		offsetof(struct Env, env_status), 2 * CACHELINE - 1);
+	cprintf("%u envs (%u runnable), cycles/env:\n", nenvs, runnable);
+	cprintf("  status scan:   before %u, after %u\n",
+		envscan_time(96, old_scan, ARRAY_SIZE(old_scan)),
+		envscan_time(sizeof(struct Env), new_scan,
+			     ARRAY_SIZE(new_scan)));
+	cprintf("  switch fields: before %u, after %u\n",
+		envscan_time(96, old_sw, ARRAY_SIZE(old_sw)),
+		envscan_time(sizeof(struct Env), new_sw,
+			     ARRAY_SIZE(new_sw)));
+	return 0;
+}
+
+
+#define SPAWNBENCH_N	16
+
+// Spawn user/hello SPAWNBENCH_N times with env_create(), then
+// SPAWNBENCH_N times from a template of one of those envs, and free
+// them all again before they get to run.
+int
+mon_spawnbench(int argc, char** argv, struct Trapframe* tf) {
+	extern uint8_t _binary_obj_user_hello_start[];
+	struct Env *es[SPAWNBENCH_N], *t;
+	uint32_t create, clone;
+	uint64_t start;
+	int i, r;
+
+	start = read_tsc();
+	for (i = 0; i < SPAWNBENCH_N; i++)
+		es[i] = env_create(_binary_obj_user_hello_start,
+				   ENV_TYPE_USER);
+	create = read_tsc() - start;
+
+	r = env_snapshot(es[0], &t);
+	for (i = 0; i < SPAWNBENCH_N; i++)
+		env_free(es[i]);
+	if (r < 0) {
+		cprintf("env_snapshot: %e\n", r);
+		return 0;
+	}
+
+	start = read_tsc();
+	for (i = 0; i < SPAWNBENCH_N; i++)
+		if ((r = env_clone(t, 0, &es[i])) < 0)
+			break;
+	clone = read_tsc() - start;
+	while (--i >= 0)
+		env_free(es[i]);
+	env_free(t);
+
+	cprintf("env_create: %u cycles/env\n", create / SPAWNBENCH_N);
+	if (r < 0)
+		cprintf("env_clone: %e\n", r);
+	else
+		cprintf("env_clone:  %u cycles/env\n", clone / SPAWNBENCH_N);
+	return 0;
+}
+
+
+// Show the accounting in one env's env_stats, trap by trap.
+static void
+ps_detail(struct Env *e)
+{
+	struct EnvStats *st = &e->env_stats;
+	int i;
+
+	cprintf("env %08x: %llu user cycles, %llu kernel cycles, "
+		"%u page faults\n", e->env_id, st->es_utime, st->es_stime,
+		st->es_pgfaults);
+	for (i = 0; i < ENV_NTRAPSTAT; i++) {
+		if (!st->es_traps[i])
+			continue;
+		if (i <= T_SIMDERR)
+			cprintf("  trap %-2d    %u\n", i, st->es_traps[i]);
+		else if (i < ENV_NTRAPSTAT - 2)
+			cprintf("  irq %-2d     %u\n", i - T_SIMDERR - 1,
+				st->es_traps[i]);
+		else
+			cprintf("  %-10s %u\n", i == ENV_NTRAPSTAT - 2
+				? "syscall" : "other", st->es_traps[i]);
+	}
+	for (i = 0; i < ENV_NSYSCALLSTAT; i++)
+		if (st->es_syscalls[i])
+			cprintf("  syscall %-2d %u\n", i, st->es_syscalls[i]);
+}
+
+int
+mon_ps(int argc, char** argv, struct Trapframe* tf) {
+	static const char *status[] = {
+		[ENV_FREE] = "free",
+		[ENV_DYING] = "dying",
+		[ENV_RUNNABLE] = "runnable",
+		[ENV_RUNNING] = "running",
+		[ENV_NOT_RUNNABLE] = "blocked",
+	};
+	struct EnvStats *st;
+	struct Env *e;
+	uint32_t i, j, nsys;
+
+	if (argc > 1) {
+		if (envid2env(strtol(argv[1], NULL, 16), &e, 0) < 0
+		    || e->env_status == ENV_FREE) {
+			cprintf("no env %s\n", argv[1]);
+			return 0;
+		}
+		ps_detail(e);
+		return 0;
+	}
+
+	cprintf("envid    status   cpu runs     user(kcyc) kernel(kcyc) "
+		"pgflt syscalls\n");
+	for (i = 0; i < nenvs; i++) {
+		e = &envs[i];
+		if (e->env_status == ENV_FREE)
+			continue;
+		st = &e->env_stats;
+		for (nsys = j = 0; j < ENV_NSYSCALLSTAT; j++)
+			nsys += st->es_syscalls[j];
+		cprintf("%08x %-8s %3d %8u %12llu %12llu %5u %8u\n",
+			e->env_id, status[e->env_status], e->env_cpunum,
+			e->env_runs, st->es_utime / 1000, st->es_stime / 1000,
+			st->es_pgfaults, nsys);
+	}
+	return 0;
+}
+
+
+int
+mon_rgroups(int argc, char** argv, struct Trapframe* tf) {
+	uint64_t total = 0;
+	struct ResGroup *g;
+	uint32_t i;
+
+	for (i = 0; i < nrgroups; i++)
+		total += rgroups[i].rg_cycles;
+	cprintf("group parent weight envs  pages  limit denied   rt     "
+		"cycles(M)  cpu%%\n");
+	for (i = 0; i < nrgroups; i++) {
+		g = &rgroups[i];
+		if (!rgroup_live(i))
+			continue;
+		cprintf("%5u %6u %6u %4u %6u %6u %6u %3u/%-3u %10llu %5llu\n",
+			i, g->rg_parent, g->rg_weight, g->rg_nenvs, g->rg_pages,
+			g->rg_page_limit, g->rg_page_denied,
+			g->rg_rt_util, g->rg_rt_limit,
+			g->rg_cycles / 1000000,
+			total ? g->rg_cycles * 100 / total : 0);
+	}
+	return 0;
+}
+
+
+int
+mon_rt(int argc, char** argv, struct Trapframe* tf) {
+	struct RtEnv *rt;
+
+	cprintf("utilization %u/%u per mille\n", rt_util, RT_UTIL_MAX);
+	cprintf("env        runtime     period   deadline   jobs "
+		"misses overruns\n");
+	for (rt = rtenvs; rt < rtenvs + NRTENV; rt++)
+		if (rt->rt_env)
+			cprintf("%08x %10u %10u %10u %6u %6u %8u\n",
+				rt->rt_env->env_id, rt->rt_runtime,
+				rt->rt_period, rt->rt_deadline, rt->rt_jobs,
+				rt->rt_misses, rt->rt_overruns);
+	return 0;
+}
+
+int
+mon_schedlat(int argc, char** argv, struct Trapframe* tf) {
+	static const char *reason[] = {
+		[SW_YIELD] = "yield",
+		[SW_BLOCK] = "block",
+		[SW_PREEMPT] = "preempt",
+		[SW_EXIT] = "exit",
+		[SW_HANDOFF] = "handoff",
+		[SW_IDLE] = "idle",
+		[SW_IPC] = "ipc",
+	};
+	struct SwitchEvent *sw;
+	struct Env *e;
+	uint32_t i, n;
+
+	if (argc > 2 && strcmp(argv[1], "trace") == 0) {
+		sched_trace_on = strcmp(argv[2], "on") == 0;
+		if (sched_trace_on)
+			sched_trace_next = 0;
+		return 0;
+	}
+	if (argc > 1) {
+		if (envid2env(strtol(argv[1], NULL, 16), &e, 0) < 0
+		    || e->env_status == ENV_FREE) {
+			cprintf("no env %s\n", argv[1]);
+			return 0;
+		}
+		cprintf("wait (cycles)   count\n");
+		for (i = 0; i < ENV_NWAITHIST; i++)
+			if (e->env_stats.es_wait[i])
+				cprintf("%s2^%-2u %12u\n",
+					i ? ">=" : "< ",
+					i + ENV_WAITHIST_MIN + (i == 0),
+					e->env_stats.es_wait[i]);
+		return 0;
+	}
+
+	cprintf("wait (cycles)   count\n");
+	for (i = 0; i < SCHED_NWAITHIST; i++)
+		if (sched_wait_hist[i])
+			cprintf(">=2^%-2u %12u\n", i, sched_wait_hist[i]);
+
+	n = MIN(sched_trace_next, SCHED_TRACE_SIZE);
+	if (n == 0)
+		return 0;
+	cprintf("cpu tsc              prev     next     reason\n");
+	for (i = sched_trace_next - n; i != sched_trace_next; i++) {
+		sw = &sched_trace[i % SCHED_TRACE_SIZE];
+		cprintf("%3u %016llx %08x %08x %s\n", sw->sw_cpu, sw->sw_tsc,
+			sw->sw_prev, sw->sw_next, reason[sw->sw_reason]);
+	}
+	return 0;
+}
+
+int
+mon_shm(int argc, char** argv, struct Trapframe* tf) {
+	struct Shm *s;
+
+	cprintf("handle   pages attached name\n");
+	for (s = shms; s < shms + NSHM; s++)
+		if (s->sh_name[0])
+			cprintf("%08x %5u %8u %s\n", shm_handle(s),
+				s->sh_npages, s->sh_nattach, s->sh_name);
+	return 0;
+}
+
+
 /***** Kernel monitor command interpreter *****/
 
 #define WHITESPACE "\t\r\n "
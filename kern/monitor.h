@@ -17,5 +17,17 @@ int mon_kerninfo(int argc, char **argv, struct Trapframe *tf);
 int mon_backtrace(int argc, char** argv, struct Trapframe* tf);
 int mon_showmappings(int argc, char** argv, struct Trapframe* tf);
 int mon_memdump(int argc, char** argv, struct Trapframe* tf);
+int mon_runq(int argc, char** argv, struct Trapframe* tf);
+int mon_percpu(int argc, char** argv, struct Trapframe* tf);
+int mon_tlb(int argc, char** argv, struct Trapframe* tf);
+int mon_workq(int argc, char** argv, struct Trapframe* tf);
+int mon_reap(int argc, char** argv, struct Trapframe* tf);
+int mon_envscan(int argc, char** argv, struct Trapframe* tf);
+int mon_spawnbench(int argc, char** argv, struct Trapframe* tf);
+int mon_ps(int argc, char** argv, struct Trapframe* tf);
+int mon_rgroups(int argc, char** argv, struct Trapframe* tf);
+int mon_rt(int argc, char** argv, struct Trapframe* tf);
+int mon_schedlat(int argc, char** argv, struct Trapframe* tf);
+int mon_shm(int argc, char** argv, struct Trapframe* tf);
 
 #endif	// !JOS_KERN_MONITOR_H
@@ -9,6 +9,9 @@
 #include <kern/pmap.h>
 #include <kern/kclock.h>
 #include <kern/env.h>
+#include <kern/cpu.h>
+#include <kern/tlb.h>
+#include <kern/rgroup.h>
 
 // These variables are set by i386_detect_memory()
 size_t npages;			// Amount of physical memory (in pages)
@@ -18,6 +21,7 @@ static size_t npages_basemem;	// Amount of base memory (in pages)
 pde_t *kern_pgdir;		// Kernel's initial page directory
 struct PageInfo *pages;		// Physical page state array
 static struct PageInfo *page_free_list;	// Free list of physical pages
+static struct PageInfo *envs_zero_page;	// Backs the unused part of UENVS
 
 
 // --------------------------------------------------------------
@@ -62,6 +66,7 @@ i386_detect_memory(void)
 // Set up memory mappings above UTOP.
 // --------------------------------------------------------------
 
+static void mem_init_mp(void);
 static void boot_map_region(pde_t *pgdir, uintptr_t va, size_t size, physaddr_t pa, int perm);
 static void check_page_free_list(bool only_low_memory);
 static void check_page_alloc(void);
@@ -125,6 +130,8 @@ mem_init(void)
 {
 	uint32_t cr0;
 	size_t n;
+	uint32_t i;
+	struct PageInfo *pp;
 
 	// Find out how much memory the machine has (npages & npages_basemem).
 	i386_detect_memory();
@@ -162,9 +169,10 @@ mem_init(void)
 
 	//////////////////////////////////////////////////////////////////////
 	// Make 'envs' point to an array of size 'NENV' of 'struct Env'.
+	// The array lives at KENVS, and env_alloc() maps its pages as
+	// they are needed.
 	// LAB 3: Your code here.
-	envs = (struct Env*)boot_alloc(NENV * sizeof(struct Env));
-	memset(envs, 0, NENV * sizeof(struct Env));
+	envs = (struct Env *) KENVS;
 
 	//////////////////////////////////////////////////////////////////////
 	// Now that we've allocated the initial kernel data structures, we set
@@ -196,8 +204,20 @@ mem_init(void)
 	// Permissions:
 	//    - the new image at UENVS  -- kernel R, user R
 	//    - envs itself -- kernel RW, user NONE
+	//
+	// envs[] grows at run time, but env_setup_vm() copies only the
+	// page directory, so create every page table for the KENVS and
+	// UENVS windows now.  Until a page of envs[] is in use, UENVS
+	// shows a zero page there: all environments free.
 	// LAB 3: Your code here.
-	boot_map_region(kern_pgdir, UENVS, PTSIZE, PADDR(envs), PTE_U);
+	if (!(pp = page_alloc(ALLOC_ZERO)))
+		panic("mem_init: out of memory for the env table");
+	for (i = 0; i < ENVS_SPAN; i += PGSIZE) {
+		if (!pgdir_walk(kern_pgdir, (void *) (KENVS + i), 1)
+		    || page_insert(kern_pgdir, pp, (void *) (UENVS + i), PTE_U) < 0)
+			panic("mem_init: out of memory for the env table");
+	}
+	envs_zero_page = pp;
 
 	//////////////////////////////////////////////////////////////////////
 	// Use the physical memory that 'bootstack' refers to as the kernel
@@ -209,8 +229,10 @@ mem_init(void)
 	//       the kernel overflows its stack, it will fault rather than
 	//       overwrite memory.  Known as a "guard page".
 	//     Permissions: kernel RW, user NONE
-	// Your code goes here:
-	boot_map_region(kern_pgdir, KSTACKTOP - KSTKSIZE, KSTKSIZE, PADDR(bootstack), PTE_W);
+	//
+	// Every CPU gets such a stack; see mem_init_mp().  CPU 0's stack
+	// is percpu_kstacks[0], and bootstack is only used until the boot
+	// CPU first enters user mode.
 
 	//////////////////////////////////////////////////////////////////////
 	// Map all of physical memory at KERNBASE.
@@ -222,6 +244,9 @@ mem_init(void)
 	// Your code goes here:
 	boot_map_region(kern_pgdir, KERNBASE, (0xffffffff - KERNBASE), 0, PTE_W);
 
+	// Initialize the SMP-related parts of the memory map
+	mem_init_mp();
+
 	// Check that the initial page directory has been set up correctly.
 	check_kern_pgdir();
 
@@ -247,6 +272,33 @@ mem_init(void)
 	check_page_installed_pgdir();
 }
 
+// Modify mappings in kern_pgdir to support SMP
+//   - Map the per-CPU stacks in the region [KSTACKTOP-PTSIZE, KSTACKTOP)
+//
+static void
+mem_init_mp(void)
+{
+	// Map per-CPU stacks starting at KSTACKTOP, for up to 'NCPU' CPUs.
+	//
+	// For CPU i, use the physical memory that 'percpu_kstacks[i]' refers
+	// to as its kernel stack. CPU i's kernel stack grows down from virtual
+	// address kstacktop_i = KSTACKTOP - i * (KSTKSIZE + KSTKGAP), and is
+	// divided into two pieces, just like the single stack you set up in
+	// mem_init:
+	//     * [kstacktop_i - KSTKSIZE, kstacktop_i)
+	//          -- backed by physical memory
+	//     * [kstacktop_i - (KSTKSIZE + KSTKGAP), kstacktop_i - KSTKSIZE)
+	//          -- not backed; so if the kernel overflows its stack,
+	//             it will fault rather than overwrite another CPU's stack.
+	//             Known as a "guard page".
+	//     Permissions: kernel RW, user NONE
+	for (int i = 0; i < NCPU; i++) {
+		uintptr_t kstacktop_i = KSTACKTOP - i * (KSTKSIZE + KSTKGAP);
+		boot_map_region(kern_pgdir, kstacktop_i - KSTKSIZE, KSTKSIZE,
+				PADDR(percpu_kstacks[i]), PTE_W);
+	}
+}
+
 // --------------------------------------------------------------
 // Tracking of physical pages.
 // The 'pages' array has one 'struct PageInfo' entry per physical page.
@@ -282,8 +334,13 @@ page_init(void)
 
 	// (1) physical page 0 as in use.
 	pages[0].pp_ref = 1;
-	// (2) free
+	// (2) free, except for the page at MPENTRY_PADDR, which holds
+	// the AP bootstrap code copied there by boot_aps().
 	for (size_t i = 1; i < npages_basemem; i++) {
+		if (i == PGNUM(MPENTRY_PADDR)) {
+			pages[i].pp_ref = 1;
+			continue;
+		}
 		pages[i].pp_ref = 0;
 		pages[i].pp_link = page_free_list; // Points to the previous one
 		page_free_list = &pages[i];
@@ -322,6 +379,9 @@ struct PageInfo *
 page_alloc(int alloc_flags)
 {
 	// Fill this function in
+	// The page may have just been unmapped from an address space
+	// that other CPUs still hold stale TLB entries for.
+	tlb_flush();
 	if (!page_free_list)
 		return NULL;
 	struct PageInfo* page = page_free_list;
@@ -344,6 +404,8 @@ page_free(struct PageInfo *pp)
 	// pp->pp_link is not NULL.
 	if (pp->pp_ref != 0 || pp->pp_link)
 		panic("Error in page free");
+	if (pp->pp_rgroup)
+		rgroup_page_free(pp);
 	pp->pp_link = page_free_list;
 	page_free_list = pp;
 }
@@ -400,6 +462,45 @@ pgdir_walk(pde_t *pgdir, const void *va, int create)
 	return (pte_t*)(KADDR(PTE_ADDR(*pde))) + PTX(va);
 }
 
+//
+// Give pgdir a private copy of the user page table covering va, if
+// that page table is shared with other page directories (see
+// env_clone).  A page table's pp_ref counts the page directories using
+// it, and it holds one reference on each page it maps however many
+// page directories share it, so the copy takes a reference on each.
+//
+// Returns 0 on success, -E_NO_MEM if out of memory.
+//
+static int
+pgtable_unshare(pde_t *pgdir, const void *va)
+{
+	pde_t *pde = pgdir + PDX(va);
+	struct PageInfo *pt, *npt;
+	pte_t *src, *dst;
+	int i;
+
+	if ((uintptr_t) va >= UTOP || !(*pde & PTE_P))
+		return 0;
+	pt = pa2page(PTE_ADDR(*pde));
+	if (pt->pp_ref == 1)
+		return 0;
+	if (!(npt = page_alloc(0)))
+		return -E_NO_MEM;
+
+	src = KADDR(PTE_ADDR(*pde));
+	dst = page2kva(npt);
+	for (i = 0; i < NPTENTRIES; i++)
+		if ((dst[i] = src[i]) & PTE_P)
+			pa2page(PTE_ADDR(src[i]))->pp_ref++;
+
+	// The copy maps the same pages with the same permissions, so
+	// no TLB entry goes stale.
+	npt->pp_ref++;
+	*pde = page2pa(npt) | (*pde & 0xFFF);
+	page_decref(pt);
+	return 0;
+}
+
 //
 // Map [va, va+size) of virtual address space to physical [pa, pa+size)
 // in the page table rooted at pgdir.  Size is a multiple of PGSIZE, and
@@ -450,6 +551,8 @@ int
 page_insert(pde_t *pgdir, struct PageInfo *pp, void *va, int perm)
 {
 	// Fill this function in
+	if (pgtable_unshare(pgdir, va) < 0)
+		return -E_NO_MEM;
 	pte_t* pte = pgdir_walk(pgdir, va, true);
 	if (!pte)
 		return -E_NO_MEM;
@@ -498,32 +601,111 @@ page_lookup(pde_t *pgdir, void *va, pte_t **pte_store)
 //   - The TLB must be invalidated if you remove an entry from
 //     the page table.
 //
+// RETURNS:
+//   0 on success
+//   -E_NO_MEM, if the page table covering 'va' is shared and there is
+//     no memory for a private copy, in which case nothing is unmapped
+//
 // Hint: The TA solution is implemented using page_lookup,
 // 	tlb_invalidate, and page_decref.
 //
-void
+int
 page_remove(pde_t *pgdir, void *va)
 {
 	// Fill this function in
 	pte_t* pte;
 	struct PageInfo* page = page_lookup(pgdir, va, &pte);
 	if (!page)
-		return;
+		return 0;
+	if (pgtable_unshare(pgdir, va) < 0)
+		return -E_NO_MEM;
+	page_lookup(pgdir, va, &pte);
 	page_decref(page);
 	tlb_invalidate(pgdir, va);
 	*pte = 0;
+	return 0;
+}
+
+//
+// Resolve a write to the copy-on-write page at va in e's address
+// space: map a private, writable copy of the page there, charged to
+// e's resource group, or just make the page writable if no other page
+// table maps it any more.
+//
+// Returns 0 on success, -E_FAULT if va is not a copy-on-write page,
+// -E_NO_MEM if out of memory.
+//
+int
+page_cow(struct Env *e, void *va)
+{
+	pde_t *pgdir = e->env_pgdir;
+	struct PageInfo *pp, *npp;
+	pte_t *pte;
+	int perm, r;
+
+	va = ROUNDDOWN(va, PGSIZE);
+	if ((uintptr_t) va >= UTOP
+	    || !page_lookup(pgdir, va, &pte) || !(*pte & PTE_COW))
+		return -E_FAULT;
+	if ((r = pgtable_unshare(pgdir, va)) < 0)
+		return r;
+
+	pp = page_lookup(pgdir, va, &pte);
+	perm = (*pte & PTE_SYSCALL & ~PTE_COW) | PTE_W;
+	if (pp->pp_ref == 1) {
+		*pte = page2pa(pp) | perm;
+		tlb_invalidate(pgdir, va);
+		return 0;
+	}
+
+	if (!(npp = rgroup_page_alloc(e, 0)))
+		return -E_NO_MEM;
+	memcpy(page2kva(npp), page2kva(pp), PGSIZE);
+	if ((r = page_insert(pgdir, npp, va, perm)) < 0) {
+		page_free(npp);
+		return r;
+	}
+	return 0;
 }
 
 //
 // Invalidate a TLB entry, but only if the page tables being
 // edited are the ones currently in use by the processor.
+// Other CPUs using pgdir are told in batches; see kern/tlb.c.
+// kern_pgdir's kernel page tables are in use in every address space.
 //
 void
 tlb_invalidate(pde_t *pgdir, void *va)
 {
 	// Flush the entry only if we're modifying the current address space.
-	// For now, there is only one address space, so always invalidate.
-	invlpg(va);
+	if (rcr3() == PADDR(pgdir) || pgdir == kern_pgdir)
+		invlpg(va);
+	tlb_shootdown(pgdir, va);
+}
+
+//
+// Reserve size bytes in the MMIO region and map [pa,pa+size) at this
+// location.  Return the base of the reserved region.  size does *not*
+// have to be multiple of PGSIZE.
+//
+void *
+mmio_map_region(physaddr_t pa, size_t size)
+{
+	// Where to start the next region.  Initially, this is the
+	// beginning of the MMIO region.  Because this is static, its
+	// value will be preserved between calls to mmio_map_region
+	// (just like nextfree in boot_alloc).
+	static uintptr_t base = MMIOBASE;
+	void *ret;
+
+	// Device memory must not be cached, so map it with PTE_PCD|PTE_PWT.
+	size = ROUNDUP(size, PGSIZE);
+	if (base + size > MMIOLIM || base + size < base)
+		panic("mmio_map_region: overflow MMIOLIM");
+	boot_map_region(kern_pgdir, base, size, pa, PTE_PCD | PTE_PWT | PTE_W);
+	ret = (void *) base;
+	base += size;
+	return ret;
 }
 
 static uintptr_t user_mem_check_addr;
@@ -550,7 +732,27 @@ int
 user_mem_check(struct Env *env, const void *va, size_t len, int perm)
 {
 	// LAB 3: Your code here.
-
+	uintptr_t start = ROUNDDOWN((uintptr_t) va, PGSIZE);
+	uintptr_t end = ROUNDUP((uintptr_t) va + len, PGSIZE);
+	pte_t *pte;
+
+	perm |= PTE_P;
+	if ((uintptr_t) va + len < (uintptr_t) va) {
+		user_mem_check_addr = (uintptr_t) va;
+		return -E_FAULT;
+	}
+	for (uintptr_t a = start; a < end; a += PGSIZE) {
+		pte = pgdir_walk(env->env_pgdir, (void *) a, 0);
+		// The kernel is about to write here for env; give env
+		// its own copy of a copy-on-write page first.
+		if ((perm & PTE_W) && a < UTOP && pte && (*pte & PTE_COW)
+		    && page_cow(env, (void *) a) == 0)
+			pte = pgdir_walk(env->env_pgdir, (void *) a, 0);
+		if (a >= ULIM || !pte || (*pte & perm) != perm) {
+			user_mem_check_addr = MAX(a, (uintptr_t) va);
+			return -E_FAULT;
+		}
+	}
 	return 0;
 }
 
@@ -624,6 +826,8 @@ check_page_free_list(bool only_low_memory)
 		assert(page2pa(pp) != EXTPHYSMEM - PGSIZE);
 		assert(page2pa(pp) != EXTPHYSMEM);
 		assert(page2pa(pp) < EXTPHYSMEM || (char *) page2kva(pp) >= first_free_page);
+		// (new test for lab 4)
+		assert(page2pa(pp) != MPENTRY_PADDR);
 
 		if (page2pa(pp) < EXTPHYSMEM)
 			++nfree_basemem;
@@ -736,27 +940,38 @@ check_kern_pgdir(void)
 	for (i = 0; i < n; i += PGSIZE)
 		assert(check_va2pa(pgdir, UPAGES + i) == PADDR(pages) + i);
 
-	// check envs array (new test for lab 3)
-	n = ROUNDUP(NENV*sizeof(struct Env), PGSIZE);
-	for (i = 0; i < n; i += PGSIZE)
-		assert(check_va2pa(pgdir, UENVS + i) == PADDR(envs) + i);
+	// check envs array (new test for lab 3): nothing in use yet
+	for (i = 0; i < ENVS_SPAN; i += PGSIZE) {
+		assert(check_va2pa(pgdir, KENVS + i) == ~0);
+		assert(check_va2pa(pgdir, UENVS + i) == page2pa(envs_zero_page));
+	}
 
 	// check phys mem
 	for (i = 0; i < npages * PGSIZE; i += PGSIZE)
 		assert(check_va2pa(pgdir, KERNBASE + i) == i);
 
 	// check kernel stack
-	for (i = 0; i < KSTKSIZE; i += PGSIZE)
-		assert(check_va2pa(pgdir, KSTACKTOP - KSTKSIZE + i) == PADDR(bootstack) + i);
-	assert(check_va2pa(pgdir, KSTACKTOP - PTSIZE) == ~0);
+	// (updated in lab 4 to check per-CPU kernel stacks)
+	for (n = 0; n < NCPU; n++) {
+		uint32_t base = KSTACKTOP - (KSTKSIZE + KSTKGAP) * (n + 1);
+		for (i = 0; i < KSTKSIZE; i += PGSIZE)
+			assert(check_va2pa(pgdir, base + KSTKGAP + i)
+				== PADDR(percpu_kstacks[n]) + i);
+		for (i = 0; i < KSTKGAP; i += PGSIZE)
+			assert(check_va2pa(pgdir, base + i) == ~0);
+	}
 
 	// check PDE permissions
 	for (i = 0; i < NPDENTRIES; i++) {
+		if ((i >= PDX(KENVS) && i < PDX(KENVS + ENVS_SPAN))
+		    || (i >= PDX(UENVS) && i < PDX(UENVS + ENVS_SPAN))) {
+			assert(pgdir[i] & PTE_P);
+			continue;
+		}
 		switch (i) {
 		case PDX(UVPT):
 		case PDX(KSTACKTOP-1):
 		case PDX(UPAGES):
-		case PDX(UENVS):
 			assert(pgdir[i] & PTE_P);
 			break;
 		default:
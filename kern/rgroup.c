@@ -0,0 +1,223 @@
+// Resource groups: proportional CPU shares and page limits.
+//
+// CPU time is shared by stride scheduling between groups.  Every cycle
+// an env uses advances its group's virtual time rg_vtime by the group's
+// stride, which is inversely proportional to its weight, and the
+// scheduler runs the queued env whose group's virtual time is lowest
+// (see rq_take_fair in sched.c).  Over time each busy group gets CPU
+// time in proportion to its weight.
+//
+// A subgroup's weight is carved out of its parent's, so the weights in
+// any subtree add up to what its top group started with, and creating
+// subgroups cannot win a group more CPU time.
+//
+// Pages that user envs ask for (sys_page_alloc, copy-on-write copies,
+// thread stacks) come from rgroup_page_alloc(), which charges them to
+// the env's group and all the groups above it, and refuses them once
+// any of those is at its limit.  A page stays charged to the group
+// that allocated it until it is freed.  Page tables and page
+// directories are not charged.
+
+#include <inc/error.h>
+#include <inc/assert.h>
+#include <inc/string.h>
+
+#include <kern/rgroup.h>
+#include <kern/env.h>
+#include <kern/pmap.h>
+
+// A group that falls this far behind the virtual clock, by sleeping,
+// catches up here, so it cannot bank its unused share and then
+// monopolize the CPU.
+#define RG_MAXLAG	((uint64_t) RG_STRIDE1 * 10000000)
+
+struct ResGroup rgroups[NRGROUP] = {
+	[0] = {
+		.rg_weight = RG_WEIGHT_MAX,
+		.rg_stride = RG_STRIDE1 / RG_WEIGHT_MAX,
+		.rg_rt_limit = RG_RT_ROOT,
+	},
+};
+uint32_t nrgroups = 1;
+
+// Virtual time of the group that most recently got the CPU.
+static uint64_t rg_vclock;
+
+//
+// Create a subgroup of group 'parent'.  Its CPU weight is taken from
+// the parent's, so a group and everything below it never get more CPU
+// than the group had alone, and the parent must keep at least 1.  Its
+// page limit may not exceed the parent's, and pages it uses count
+// against every group above it as well (see rgroup_page_alloc).  Its
+// real-time budget of rt_limit per mille is taken from the parent's.
+// Returns the new group's id, or
+//	-E_INVAL if weight is not in 1..parent's weight - 1,
+//	-E_INVAL if the parent has a page limit and page_limit is 0 or
+//		above it,
+//	-E_OVERLOAD if the parent has less than rt_limit budget left,
+//	-E_NO_MEM if all NRGROUP groups exist.
+//
+int
+rgroup_create(uint32_t parent, uint32_t weight, uint32_t page_limit,
+	      uint32_t rt_limit)
+{
+	struct ResGroup *p = &rgroups[parent];
+	struct ResGroup *g;
+	uint32_t gid;
+
+	assert(rgroup_live(parent));
+	if (weight < 1 || weight >= p->rg_weight)
+		return -E_INVAL;
+	if (p->rg_page_limit
+	    && (page_limit == 0 || page_limit > p->rg_page_limit))
+		return -E_INVAL;
+	if (rt_limit > p->rg_rt_limit - p->rg_rt_util)
+		return -E_OVERLOAD;
+	for (gid = 1; gid < nrgroups && rgroup_live(gid); gid++)
+		/* do nothing */;
+	if (gid == NRGROUP)
+		return -E_NO_MEM;
+
+	g = &rgroups[gid];
+	memset(g, 0, sizeof(*g));
+	g->rg_parent = parent;
+	g->rg_weight = weight;
+	g->rg_stride = RG_STRIDE1 / weight;
+	g->rg_vtime = rg_vclock;
+	g->rg_page_limit = page_limit;
+	g->rg_rt_limit = rt_limit;
+	p->rg_weight -= weight;
+	p->rg_stride = RG_STRIDE1 / p->rg_weight;
+	p->rg_rt_util += rt_limit;
+	if (gid == nrgroups)
+		nrgroups++;
+	return gid;
+}
+
+//
+// Destroy group gid, which must not be the root, and give its CPU
+// weight and real-time budget back to its parent.  Pages still charged
+// to it pass to its parent, which already counts them.
+// Returns 0 on success, or
+//	-E_INVAL if gid still has envs, subgroups or real-time envs.
+//
+int
+rgroup_destroy(uint32_t gid)
+{
+	struct ResGroup *g = &rgroups[gid];
+	struct ResGroup *p = &rgroups[g->rg_parent];
+	uint32_t i;
+
+	assert(gid != 0 && rgroup_live(gid));
+	if (g->rg_nenvs || g->rg_rt_util)
+		return -E_INVAL;
+	for (i = 1; i < nrgroups; i++)
+		if (rgroup_live(i) && rgroups[i].rg_parent == gid)
+			return -E_INVAL;
+
+	if (g->rg_pages)
+		for (i = 0; i < npages; i++)
+			if (pages[i].pp_rgroup == gid + 1)
+				pages[i].pp_rgroup = g->rg_parent + 1;
+	p->rg_weight += g->rg_weight;
+	p->rg_stride = RG_STRIDE1 / p->rg_weight;
+	p->rg_rt_util -= g->rg_rt_limit;
+	g->rg_weight = 0;
+	return 0;
+}
+
+// Returns whether group gid is group 'ancestor' or below it.
+bool
+rgroup_within(uint32_t gid, uint32_t ancestor)
+{
+	// The root is its own parent.
+	for (; gid != ancestor && gid != 0; gid = rgroups[gid].rg_parent)
+		/* do nothing */;
+	return gid == ancestor;
+}
+
+// Move e into group gid.  Pages e allocated earlier stay charged to
+// its old group.
+void
+rgroup_join(struct Env *e, uint32_t gid)
+{
+	assert(rgroup_live(gid));
+	rgroups[e->env_rgroup].rg_nenvs--;
+	e->env_rgroup = gid;
+	rgroups[gid].rg_nenvs++;
+}
+
+// e is being freed.
+void
+rgroup_leave(struct Env *e)
+{
+	rgroups[e->env_rgroup].rg_nenvs--;
+}
+
+// Charge e's group for cycles of CPU time.
+void
+rgroup_charge(struct Env *e, uint64_t cycles)
+{
+	struct ResGroup *g = &rgroups[e->env_rgroup];
+
+	g->rg_cycles += cycles;
+	g->rg_vtime += cycles * g->rg_stride;
+}
+
+// The scheduler has picked e to run next.
+void
+rgroup_dispatch(struct Env *e)
+{
+	struct ResGroup *g = &rgroups[e->env_rgroup];
+
+	if (g->rg_vtime > rg_vclock)
+		rg_vclock = g->rg_vtime;
+	else if (rg_vclock - g->rg_vtime > RG_MAXLAG)
+		g->rg_vtime = rg_vclock - RG_MAXLAG;
+}
+
+//
+// Allocate a page for e with page_alloc, charging it to e's group and
+// every group above it.  Returns NULL if out of memory or if any of
+// those groups is at its page limit.
+//
+struct PageInfo *
+rgroup_page_alloc(struct Env *e, int alloc_flags)
+{
+	struct PageInfo *pp;
+	struct ResGroup *g;
+	uint32_t gid;
+
+	for (gid = e->env_rgroup; ; gid = g->rg_parent) {
+		g = &rgroups[gid];
+		if (g->rg_page_limit && g->rg_pages >= g->rg_page_limit) {
+			rgroups[e->env_rgroup].rg_page_denied++;
+			return NULL;
+		}
+		if (gid == 0)
+			break;
+	}
+	if (!(pp = page_alloc(alloc_flags)))
+		return NULL;
+	pp->pp_rgroup = e->env_rgroup + 1;
+	for (gid = e->env_rgroup; ; gid = rgroups[gid].rg_parent) {
+		rgroups[gid].rg_pages++;
+		if (gid == 0)
+			break;
+	}
+	return pp;
+}
+
+// pp is being freed; uncharge its group and the groups above it.
+void
+rgroup_page_free(struct PageInfo *pp)
+{
+	uint32_t gid;
+
+	for (gid = pp->pp_rgroup - 1; ; gid = rgroups[gid].rg_parent) {
+		rgroups[gid].rg_pages--;
+		if (gid == 0)
+			break;
+	}
+	pp->pp_rgroup = 0;
+}
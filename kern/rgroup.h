@@ -0,0 +1,64 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_RGROUP_H
+#define JOS_KERN_RGROUP_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+
+struct Env;
+struct PageInfo;
+
+#define NRGROUP			16	// Resource groups, including the root
+#define RG_WEIGHT_MAX		1024
+#define RG_STRIDE1		(1 << 14)	// rg_stride at weight 1
+#define RG_RT_ROOT		500	// Root's real-time budget, per mille
+
+// A resource group shares CPU time and memory among its envs.  Group 0
+// is the root group, which the kernel's own envs belong to.  Envs
+// start out in their parent's group.  Groups form a tree: an env's
+// group can create subgroups, whose CPU weight and real-time budget
+// are carved out of its own and whose pages count against its limit
+// too, and envs can only be moved down the tree from their own group.
+// Real-time utilization (see sched_rt_set) is admitted against the
+// budget of the group the env is in.  A group with no envs and no
+// subgroups can be destroyed, and its slot reused; free slots have
+// weight 0.
+struct ResGroup {
+	uint32_t rg_parent;		// Group that created this one
+	uint32_t rg_weight;		// Share of CPU time, 1..RG_WEIGHT_MAX
+	uint32_t rg_stride;		// RG_STRIDE1 / rg_weight
+	uint64_t rg_vtime;		// Cycles used, times rg_stride
+	uint32_t rg_page_limit;		// Most pages charged at once, 0 = any
+	uint32_t rg_pages;		// Pages charged now, subgroups' too
+	uint32_t rg_page_denied;	// Allocations refused by the limit
+	uint32_t rg_nenvs;		// Envs in the group
+	uint32_t rg_rt_limit;		// Real-time budget, per mille of a CPU
+	uint32_t rg_rt_util;		// ... admitted or given to subgroups
+	uint64_t rg_cycles;		// Cycles used by the group's envs
+};
+
+extern struct ResGroup rgroups[NRGROUP];
+extern uint32_t nrgroups;		// Slots ever used
+
+// Returns whether gid names a group that exists.
+static inline bool
+rgroup_live(uint32_t gid)
+{
+	return gid < nrgroups && rgroups[gid].rg_weight != 0;
+}
+
+int	rgroup_create(uint32_t parent, uint32_t weight, uint32_t page_limit,
+		      uint32_t rt_limit);
+int	rgroup_destroy(uint32_t gid);
+bool	rgroup_within(uint32_t gid, uint32_t ancestor);
+void	rgroup_join(struct Env *e, uint32_t gid);
+void	rgroup_leave(struct Env *e);
+void	rgroup_charge(struct Env *e, uint64_t cycles);
+void	rgroup_dispatch(struct Env *e);
+struct PageInfo *rgroup_page_alloc(struct Env *e, int alloc_flags);
+void	rgroup_page_free(struct PageInfo *pp);
+
+#endif	// !JOS_KERN_RGROUP_H
@@ -0,0 +1,586 @@
+#include <inc/assert.h>
+#include <inc/x86.h>
+#include <inc/error.h>
+#include <inc/string.h>
+#include <kern/env.h>
+#include <kern/pmap.h>
+#include <kern/monitor.h>
+#include <kern/sched.h>
+#include <kern/tlb.h>
+#include <kern/rgroup.h>
+
+struct RunQueue runqueues[NCPU];
+
+// The real-time class.  An env in it has a budget of rt_runtime cycles
+// in every period of rt_period cycles, and each period's job should be
+// finished, by calling sys_rt_wait, within rt_deadline of the period's
+// start.  Among real-time envs that are runnable and have budget left,
+// sched_yield() runs the one with the earliest deadline, before any
+// env on the run queues.  An env that uses up its budget is taken off
+// the run queues until its next period, so it cannot starve the other
+// envs either.  Budgets are enforced at timer-tick granularity.
+//
+// Admission control keeps the total rt_util within RT_UTIL_MAX of one
+// CPU, which EDF can always schedule, and each resource group's within
+// its real-time budget, so that envs cannot admit themselves and
+// starve the time-sharing envs.
+struct RtEnv rtenvs[NRTENV];
+uint32_t rt_util;			// Sum of the admitted rt_util
+static uint32_t rt_count;		// Slots in use
+
+// Run queue latency: how long envs wait between becoming runnable
+// (env_queued, stamped by sched_enqueue and sched_yield) and running
+// (sched_note_wait, called by env_run).  Each env keeps a coarse
+// histogram in its env_stats; sched_wait_hist covers every env.
+// Switches can also be logged to the sched_trace ring.
+uint32_t sched_wait_hist[SCHED_NWAITHIST];
+struct SwitchEvent sched_trace[SCHED_TRACE_SIZE];
+uint32_t sched_trace_next;
+bool sched_trace_on;
+
+static void sched_halt(void) __attribute__((noreturn));
+
+void
+sched_init(void)
+{
+	int i;
+
+	for (i = 0; i < NCPU; i++) {
+		spin_initlock(&runqueues[i].rq_lock);
+		cpus[i].cpu_rq = &runqueues[i];
+	}
+}
+
+// Append e to rq.  The caller must hold rq's lock.
+static void
+rq_push(struct RunQueue *rq, struct Env *e)
+{
+	e->env_rq = rq - runqueues;
+	e->env_rq_next = NULL;
+	e->env_rq_prev = rq->rq_tail;
+	if (rq->rq_tail)
+		rq->rq_tail->env_rq_next = e;
+	else
+		rq->rq_head = e;
+	rq->rq_tail = e;
+	rq->rq_len++;
+}
+
+// Unlink e from rq.  The caller must hold rq's lock.
+static void
+rq_remove(struct RunQueue *rq, struct Env *e)
+{
+	if (e->env_rq_prev)
+		e->env_rq_prev->env_rq_next = e->env_rq_next;
+	else
+		rq->rq_head = e->env_rq_next;
+	if (e->env_rq_next)
+		e->env_rq_next->env_rq_prev = e->env_rq_prev;
+	else
+		rq->rq_tail = e->env_rq_prev;
+	e->env_rq_next = e->env_rq_prev = NULL;
+	e->env_rq = -1;
+	rq->rq_len--;
+}
+
+// Remove and return the env at the head (tail == 0) or at the tail
+// (tail == 1) of rq, or NULL if rq is empty.
+static struct Env *
+rq_take(struct RunQueue *rq, bool tail)
+{
+	struct Env *e;
+
+	spin_lock(&rq->rq_lock);
+	if ((e = tail ? rq->rq_tail : rq->rq_head))
+		rq_remove(rq, e);
+	spin_unlock(&rq->rq_lock);
+	return e;
+}
+
+// Remove and return the env on rq whose resource group has had the
+// least of its share of CPU time, the one nearest the head among envs
+// of that group, or NULL if rq is empty.  See kern/rgroup.c.
+static struct Env *
+rq_take_fair(struct RunQueue *rq)
+{
+	struct Env *e, *best;
+
+	spin_lock(&rq->rq_lock);
+	best = rq->rq_head;
+	if (nrgroups > 1)
+		for (e = rq->rq_head; e; e = e->env_rq_next)
+			if (rgroups[e->env_rgroup].rg_vtime
+			    < rgroups[best->env_rgroup].rg_vtime)
+				best = e;
+	if (best)
+		rq_remove(rq, best);
+	spin_unlock(&rq->rq_lock);
+	return best;
+}
+
+// Return the longest run queue other than rq, or NULL if there is
+// only one CPU.  Queue lengths are read without locking; a stale
+// answer only makes us steal or balance a little less well.
+static struct RunQueue *
+rq_busiest(struct RunQueue *rq)
+{
+	struct RunQueue *busiest = NULL;
+	int i;
+
+	for (i = 0; i < ncpu; i++)
+		if (&runqueues[i] != rq
+		    && (!busiest || runqueues[i].rq_len > busiest->rq_len))
+			busiest = &runqueues[i];
+	return busiest;
+}
+
+//
+// Put the runnable environment e on a run queue.
+// e goes back to the CPU it last ran on, whose caches may still hold
+// its working set.  Envs that have never run go to the shortest queue.
+//
+void
+sched_enqueue(struct Env *e)
+{
+	struct RunQueue *rq;
+	int i, cpu = e->env_cpunum;
+
+	assert(e->env_status == ENV_RUNNABLE && e->env_rq < 0);
+	if (cpu < 0 || cpu >= ncpu) {
+		cpu = thiscpu->cpu_id;
+		for (i = 0; i < ncpu; i++)
+			if (runqueues[i].rq_len < runqueues[cpu].rq_len)
+				cpu = i;
+	}
+
+	e->env_queued = read_tsc();
+	rq = &runqueues[cpu];
+	spin_lock(&rq->rq_lock);
+	rq_push(rq, e);
+	spin_unlock(&rq->rq_lock);
+}
+
+//
+// e, which became runnable at e->env_queued, is about to run.
+// Record how long it waited.
+//
+void
+sched_note_wait(struct Env *e, uint64_t now)
+{
+	uint64_t wait = now - e->env_queued;
+	int b;
+
+	b = wait >> 32 ? 31 : wait ? 31 - __builtin_clz(wait) : 0;
+	sched_wait_hist[b]++;
+	b = MIN(MAX(b - ENV_WAITHIST_MIN, 0), ENV_NWAITHIST - 1);
+	e->env_stats.es_wait[b]++;
+}
+
+// Log a switch from prev to next in the trace ring, if it is on.
+static void
+sched_trace_switch(struct Env *prev, struct Env *next, int reason)
+{
+	struct SwitchEvent *sw;
+
+	if (!sched_trace_on || prev == next)
+		return;
+	sw = &sched_trace[sched_trace_next++ % SCHED_TRACE_SIZE];
+	sw->sw_tsc = read_tsc();
+	sw->sw_prev = prev ? prev->env_id : 0;
+	sw->sw_next = next->env_id;
+	sw->sw_cpu = thiscpu->cpu_id;
+	sw->sw_reason = reason;
+}
+
+//
+// Take e off whichever run queue it is on, if any.
+//
+void
+sched_dequeue(struct Env *e)
+{
+	struct RunQueue *rq;
+	int q;
+
+	// e may move between queues until we hold the right lock.
+	while ((q = e->env_rq) >= 0) {
+		rq = &runqueues[q];
+		spin_lock(&rq->rq_lock);
+		if (e->env_rq == q)
+			rq_remove(rq, e);
+		spin_unlock(&rq->rq_lock);
+	}
+}
+
+//
+// Called by a CPU whose own queue has run dry.  Steal the env that
+// would wait longest on the busiest other queue.
+//
+static struct Env *
+sched_steal(struct RunQueue *rq)
+{
+	struct RunQueue *busiest;
+	struct Env *e;
+
+	busiest = rq_busiest(rq);
+	if (!busiest || busiest->rq_len < SCHED_STEAL_MIN)
+		return NULL;
+	if ((e = rq_take(busiest, 1)))
+		rq->rq_steals++;
+	return e;
+}
+
+//
+// Called on every timer interrupt.
+// Every SCHED_BALANCE_TICKS ticks, pull envs from the busiest queue onto
+// this CPU's queue until the two differ by less than SCHED_IMBALANCE.
+// This catches imbalances that idle stealing does not, such as one CPU
+// with a long queue while every other CPU still has one waiting env.
+//
+void
+sched_tick(void)
+{
+	struct RunQueue *rq = this_cpu_read(cpu_rq), *busiest;
+	struct Env *e;
+
+	if (++rq->rq_ticks % SCHED_BALANCE_TICKS != 0)
+		return;
+	if (!(busiest = rq_busiest(rq)))
+		return;
+
+	while (busiest->rq_len >= rq->rq_len + SCHED_IMBALANCE) {
+		if (!(e = rq_take(busiest, 1)))
+			break;
+		spin_lock(&rq->rq_lock);
+		rq_push(rq, e);
+		spin_unlock(&rq->rq_lock);
+		rq->rq_pulls++;
+	}
+}
+
+//
+// Hand the rest of the current env's time slice to e: if e is waiting
+// on any run queue, run it on this CPU now, ahead of everything
+// queued, and put the current env at the tail of this CPU's queue.
+// Returns only if e is not runnable; the caller should then yield as
+// usual.
+//
+void
+sched_yield_to(struct Env *e)
+{
+	struct RunQueue *rq = this_cpu_read(cpu_rq);
+
+	if (e->env_status != ENV_RUNNABLE
+	    || e->env_type == ENV_TYPE_KTHREAD) {
+		rq->rq_handoff_misses++;
+		return;
+	}
+	rq->rq_handoffs++;
+	rgroup_dispatch(e);
+	sched_trace_switch(curenv, e, SW_HANDOFF);
+	env_run(e);
+}
+
+//
+// Run e on this CPU now, for the rest of the current env's time slice.
+// The current env has just woken e with an IPC message (see
+// sys_ipc_try_send), so e skips the run queues and this skips the
+// pass over them.  The current env goes to the tail of its queue if
+// it is still runnable.
+//
+void
+sched_ipc_switch(struct Env *e)
+{
+	e->env_status = ENV_RUNNABLE;
+	e->env_queued = read_tsc();
+	rgroup_dispatch(e);
+	sched_trace_switch(curenv, e, SW_IPC);
+	env_run(e);
+}
+
+static struct RtEnv *
+rt_of(struct Env *e)
+{
+	return e->env_rt ? &rtenvs[e->env_rt - 1] : NULL;
+}
+
+// Start a new period for rt at 'release', making its env runnable
+// again if it was waiting for one.
+static void
+rt_release(struct RtEnv *rt, uint64_t release)
+{
+	struct Env *e = rt->rt_env;
+
+	rt->rt_release = release;
+	rt->rt_budget = rt->rt_runtime;
+	rt->rt_done = 0;
+	rt->rt_jobs++;
+	if (rt->rt_blocked) {
+		rt->rt_blocked = 0;
+		if (e->env_status == ENV_NOT_RUNNABLE) {
+			e->env_status = ENV_RUNNABLE;
+			sched_enqueue(e);
+		}
+	}
+}
+
+// Start the periods that are due, and take envs that have used up
+// their budget off the run queues.
+static void
+rt_update(uint64_t now)
+{
+	struct RtEnv *rt;
+	struct Env *e;
+	uint64_t periods;
+
+	for (rt = rtenvs; rt < rtenvs + NRTENV; rt++) {
+		if (!(e = rt->rt_env))
+			continue;
+		if (now - rt->rt_release >= rt->rt_period) {
+			// The last job never finished.
+			if (!rt->rt_done)
+				rt->rt_misses++;
+			periods = (now - rt->rt_release) / rt->rt_period;
+			rt_release(rt, rt->rt_release + periods * rt->rt_period);
+		} else if (rt->rt_budget <= 0 && !rt->rt_blocked
+			   && e->env_status == ENV_RUNNABLE) {
+			sched_dequeue(e);
+			e->env_status = ENV_NOT_RUNNABLE;
+			rt->rt_blocked = 1;
+		}
+	}
+}
+
+// Return the runnable real-time env with budget left whose deadline is
+// earliest, or NULL.
+static struct Env *
+rt_pick(void)
+{
+	struct RtEnv *rt, *best = NULL;
+
+	for (rt = rtenvs; rt < rtenvs + NRTENV; rt++)
+		if (rt->rt_env && rt->rt_env->env_status == ENV_RUNNABLE
+		    && !rt->rt_done && rt->rt_budget > 0
+		    && (!best || rt->rt_release + rt->rt_deadline
+				 < best->rt_release + best->rt_deadline))
+			best = rt;
+	return best ? best->rt_env : NULL;
+}
+
+//
+// Put e in the real-time class with the given budget, period and
+// relative deadline, all in TSC cycles, or take it out if runtime is
+// 0.  e's first period starts now.
+//
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_INVAL unless 0 < runtime <= deadline <= period.
+//	-E_OVERLOAD if admitting e would take the real-time envs past
+//		RT_UTIL_MAX, or e's resource group past its real-time
+//		budget, or all NRTENV slots are in use.
+//
+int
+sched_rt_set(struct Env *e, uint32_t runtime, uint32_t period,
+	     uint32_t deadline)
+{
+	struct RtEnv *rt = rt_of(e);
+	struct ResGroup *g = &rgroups[e->env_rgroup];
+	uint32_t util;
+
+	if (runtime == 0) {
+		if (rt && rt->rt_blocked && e->env_status == ENV_NOT_RUNNABLE) {
+			e->env_status = ENV_RUNNABLE;
+			sched_enqueue(e);
+		}
+		sched_rt_remove(e);
+		return 0;
+	}
+	if (runtime > deadline || deadline > period)
+		return -E_INVAL;
+
+	util = ((uint64_t) runtime * 1000 + period - 1) / period;
+	if (rt_util - (rt ? rt->rt_util : 0) + util > RT_UTIL_MAX)
+		return -E_OVERLOAD;
+	if (g->rg_rt_util + util
+	    - (rt && rt->rt_rgroup == e->env_rgroup ? rt->rt_util : 0)
+	    > g->rg_rt_limit)
+		return -E_OVERLOAD;
+	if (!rt) {
+		for (rt = rtenvs; rt < rtenvs + NRTENV && rt->rt_env; rt++)
+			/* do nothing */;
+		if (rt == rtenvs + NRTENV)
+			return -E_OVERLOAD;
+		memset(rt, 0, sizeof(*rt));
+		rt->rt_env = e;
+		e->env_rt = rt - rtenvs + 1;
+		rt_count++;
+	} else {
+		rt_util -= rt->rt_util;
+		rgroups[rt->rt_rgroup].rg_rt_util -= rt->rt_util;
+	}
+
+	rt->rt_runtime = runtime;
+	rt->rt_period = period;
+	rt->rt_deadline = deadline;
+	rt->rt_util = util;
+	rt->rt_rgroup = e->env_rgroup;
+	rt_util += util;
+	g->rg_rt_util += util;
+	rt_release(rt, read_tsc());
+	return 0;
+}
+
+// Take e out of the real-time class, if it is in it.  Leaves e's
+// status and run queue alone.
+void
+sched_rt_remove(struct Env *e)
+{
+	struct RtEnv *rt = rt_of(e);
+
+	if (!rt)
+		return;
+	rt_util -= rt->rt_util;
+	rgroups[rt->rt_rgroup].rg_rt_util -= rt->rt_util;
+	rt->rt_env = NULL;
+	e->env_rt = 0;
+	rt_count--;
+}
+
+// e has run for 'cycles'; take them out of its real-time budget.
+void
+sched_rt_charge(struct Env *e, uint64_t cycles)
+{
+	struct RtEnv *rt = rt_of(e);
+
+	if (!rt)
+		return;
+	if (rt->rt_budget > 0 && (rt->rt_budget -= cycles) <= 0 && !rt->rt_done)
+		rt->rt_overruns++;
+}
+
+//
+// e, which is running, has finished this period's job.  It does not
+// run again until its next period starts.  The caller must then give
+// up the CPU.
+//
+// Returns e's total of missed deadlines, or -E_INVAL if e is not in the
+// real-time class.
+//
+int
+sched_rt_wait(struct Env *e)
+{
+	struct RtEnv *rt = rt_of(e);
+
+	if (!rt)
+		return -E_INVAL;
+	if (read_tsc() - rt->rt_release > rt->rt_deadline)
+		rt->rt_misses++;
+	rt->rt_done = 1;
+	rt->rt_blocked = 1;
+	e->env_status = ENV_NOT_RUNNABLE;
+	return rt->rt_misses;
+}
+
+//
+// Choose a user environment to run and run it.
+//
+void
+sched_yield(void)
+{
+	struct RunQueue *rq = this_cpu_read(cpu_rq);
+	struct Env *e, *prev = curenv;
+	uint32_t reason = this_cpu_read(cpu_swreason);
+	struct RtEnv *rt;
+
+	this_cpu_write(cpu_swreason, SW_YIELD);
+	if (!prev)
+		reason = SW_IDLE;
+	else if (reason == SW_YIELD && prev->env_status != ENV_RUNNING)
+		reason = SW_BLOCK;
+
+	if (rt_count)
+		rt_update(read_tsc());
+
+	// A real-time env out of budget waits for its next period.
+	if (curenv && curenv->env_status == ENV_RUNNING
+	    && (rt = rt_of(curenv)) && rt->rt_budget <= 0) {
+		curenv->env_status = ENV_NOT_RUNNABLE;
+		rt->rt_blocked = 1;
+	}
+
+	// Round-robin within this CPU's queue: the current env goes to
+	// the tail, so every env already waiting here runs before it
+	// does again.  With more than one resource group, the group
+	// furthest behind its CPU share goes first, round-robin among
+	// its envs.  If it is the only env here it is simply chosen
+	// again.  The big kernel lock keeps other CPUs from stealing it
+	// before we have left it.
+	if (curenv && curenv->env_status == ENV_RUNNING) {
+		curenv->env_status = ENV_RUNNABLE;
+		curenv->env_queued = read_tsc();
+		spin_lock(&rq->rq_lock);
+		rq_push(rq, curenv);
+		spin_unlock(&rq->rq_lock);
+	}
+
+	// Real-time envs go first.  If this CPU has nothing to run,
+	// take work from the busiest CPU before halting.
+	if ((rt_count && (e = rt_pick()))
+	    || (e = rq_take_fair(rq)) || (e = sched_steal(rq))) {
+		rgroup_dispatch(e);
+		sched_trace_switch(prev, e, reason);
+		env_run(e);
+	}
+
+	// sched_halt never returns
+	sched_halt();
+}
+
+// Halt this CPU when there is nothing to do. Wait until the
+// timer interrupt wakes it up. This function never returns.
+//
+static void
+sched_halt(void)
+{
+	int i;
+
+	// For debugging and testing purposes, if there are no runnable
+	// environments in the system, then drop into the kernel monitor.
+	for (i = 0; i < nenvs; i++) {
+		if ((envs[i].env_status == ENV_RUNNABLE ||
+		     envs[i].env_status == ENV_RUNNING ||
+		     envs[i].env_status == ENV_DYING))
+			break;
+	}
+	// Real-time envs waiting for their next period will be back.
+	if (i == nenvs && !rt_count) {
+		cprintf("No runnable environments in the system!\n");
+		while (1)
+			monitor(NULL);
+	}
+
+	// Mark that no environment is running on this CPU
+	this_cpu_write(cpu_env, NULL);
+	tlb_switch(kern_pgdir);
+	tlb_flush();
+
+	// Mark that this CPU is in the HALT state, so that when
+	// timer interupts come in, we know we should re-acquire the
+	// big kernel lock
+	xchg(&thiscpu->cpu_status, CPU_HALTED);
+
+	// Release the big kernel lock as if we were "leaving" the kernel
+	unlock_kernel();
+
+	// Reset stack pointer, enable interrupts and then halt.
+	asm volatile (
+		"movl $0, %%ebp\n"
+		"movl %0, %%esp\n"
+		"pushl $0\n"
+		"pushl $0\n"
+		"sti\n"
+		"1:\n"
+		"hlt\n"
+		"jmp 1b\n"
+	: : "a" (KSTACKTOP_CPU(thiscpu->cpu_id)));
+
+	panic("sched_halt: halted CPU resumed");
+}
@@ -0,0 +1,107 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_SCHED_H
+#define JOS_KERN_SCHED_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/mmu.h>
+#include <kern/cpu.h>
+#include <kern/spinlock.h>
+
+// Run queue tuning knobs; see sched.c for how they are used.
+#define SCHED_STEAL_MIN		1	// idle CPUs steal from queues this long
+#define SCHED_BALANCE_TICKS	4	// timer ticks between balancer runs
+#define SCHED_IMBALANCE		2	// balance queues differing by this much
+
+// Each CPU owns a queue of ENV_RUNNABLE environments, linked through
+// env_rq_next/env_rq_prev.  The queues are cache-line aligned so that
+// one CPU's enqueues and dequeues do not bounce another CPU's queue.
+struct RunQueue {
+	struct spinlock rq_lock;
+	struct Env *rq_head;		// Next env to run
+	struct Env *rq_tail;
+	volatile uint32_t rq_len;	// Number of envs on the queue
+	uint32_t rq_ticks;		// Timer ticks taken by this CPU
+
+	// Envs moved onto this queue from other CPUs' queues
+	uint32_t rq_steals;		// ... by this CPU when it ran dry
+	uint32_t rq_pulls;		// ... by the periodic balancer
+
+	// sched_yield_to() calls on this CPU
+	uint32_t rq_handoffs;		// ... that ran the target at once
+	uint32_t rq_handoff_misses;	// ... whose target was not runnable
+} __attribute__((aligned(CACHELINE)));
+
+extern struct RunQueue runqueues[NCPU];
+
+// Real-time class, scheduled earliest deadline first ahead of the
+// run queues.  Times are in TSC cycles.  See sched.c.
+#define NRTENV		16	// Envs in the real-time class at once
+#define RT_UTIL_MAX	900	// Admissible utilization, per mille of a CPU
+
+struct RtEnv {
+	struct Env *rt_env;		// NULL if this slot is free
+	uint32_t rt_runtime;		// Budget per period
+	uint32_t rt_period;
+	uint32_t rt_deadline;		// Relative to the start of a period
+	uint32_t rt_util;		// rt_runtime / rt_period, per mille
+	uint32_t rt_rgroup;		// Resource group rt_util is charged to
+	uint64_t rt_release;		// Start of the current period
+	int64_t rt_budget;		// Budget left in this period
+	bool rt_done;			// This period's job has finished
+	bool rt_blocked;		// Not runnable until the next period
+	uint32_t rt_jobs;		// Periods started
+	uint32_t rt_misses;		// Jobs that finished late or never
+	uint32_t rt_overruns;		// Jobs that ran out of budget
+};
+
+// Why a CPU switched envs, in the switch trace.  Callers of
+// sched_yield() other than the ones below set cpu_swreason first.
+enum {
+	SW_YIELD = 0,		// The env gave up the CPU
+	SW_BLOCK,		// The env stopped being runnable
+	SW_PREEMPT,		// Timer tick
+	SW_EXIT,		// The env was destroyed
+	SW_HANDOFF,		// sys_yield_to
+	SW_IDLE,		// The CPU had nothing running
+	SW_IPC,			// An IPC message woke the next env
+};
+
+#define SCHED_NWAITHIST		32	// System-wide: one bucket per log2
+#define SCHED_TRACE_SIZE	256	// Switch events kept
+
+struct SwitchEvent {
+	uint64_t sw_tsc;
+	envid_t sw_prev;		// 0 if none
+	envid_t sw_next;
+	uint8_t sw_cpu;
+	uint8_t sw_reason;		// SW_*
+};
+
+extern uint32_t sched_wait_hist[SCHED_NWAITHIST];
+extern struct SwitchEvent sched_trace[SCHED_TRACE_SIZE];
+extern uint32_t sched_trace_next;	// Events recorded so far
+extern bool sched_trace_on;
+
+extern struct RtEnv rtenvs[NRTENV];
+extern uint32_t rt_util;
+
+void sched_init(void);
+void sched_enqueue(struct Env *e);
+void sched_dequeue(struct Env *e);
+void sched_tick(void);
+void sched_yield_to(struct Env *e);
+void sched_ipc_switch(struct Env *e) __attribute__((noreturn));
+void sched_note_wait(struct Env *e, uint64_t now);
+int sched_rt_set(struct Env *e, uint32_t runtime, uint32_t period,
+		 uint32_t deadline);
+void sched_rt_remove(struct Env *e);
+void sched_rt_charge(struct Env *e, uint64_t cycles);
+int sched_rt_wait(struct Env *e);
+
+// This function does not return.
+void sched_yield(void) __attribute__((noreturn));
+
+#endif	// !JOS_KERN_SCHED_H
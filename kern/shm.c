@@ -0,0 +1,228 @@
+// Named shared-memory segments (see inc/shm.h).
+//
+// A segment's handle is its slot in shms[] plus the slot's generation
+// shifted above it, so a handle goes stale when its segment is freed,
+// the way an envid does.  Attachments are kept per address space, not
+// per env: threads share theirs, and env_free_vm() detaches whatever
+// is left when the last thread goes.  Mappings of segment pages carry
+// PTE_SHARE, so that env_snapshot() leaves them shared rather than
+// copy-on-write.
+
+#include <inc/error.h>
+#include <inc/mmu.h>
+#include <inc/string.h>
+
+#include <kern/shm.h>
+#include <kern/env.h>
+#include <kern/pmap.h>
+#include <kern/rgroup.h>
+
+#define SHM_GENSHIFT	8
+
+struct Shm shms[NSHM];
+static struct ShmAttach shm_attaches[NSHMATTACH];
+
+// Returns the handle of live segment s.
+int
+shm_handle(struct Shm *s)
+{
+	static_assert(NSHM <= (1 << SHM_GENSHIFT));
+	return (s->sh_gen << SHM_GENSHIFT) | (s - shms);
+}
+
+static struct Shm *
+handle2shm(int handle)
+{
+	struct Shm *s;
+
+	if (handle < 0 || (handle & ((1 << SHM_GENSHIFT) - 1)) >= NSHM)
+		return NULL;
+	s = &shms[handle & ((1 << SHM_GENSHIFT) - 1)];
+	if (!s->sh_name[0] || shm_handle(s) != handle)
+		return NULL;
+	return s;
+}
+
+// Drop the segment's own page references and free its slot.
+static void
+shm_free(struct Shm *s)
+{
+	uint32_t i;
+
+	for (i = 0; i < s->sh_npages; i++)
+		page_decref(s->sh_pages[i]);
+	s->sh_name[0] = '\0';
+	s->sh_npages = 0;
+	// Keep handles positive.
+	s->sh_gen = (s->sh_gen + 1) & 0x7fffff;
+}
+
+// Free attachment a, first unmapping the pages of it that still map
+// the segment if 'unmap'.  Frees the segment if that was its last
+// attachment.
+// Returns 0 on success, or -E_NO_MEM from page_remove(), in which case
+// a stays attached, with some of its pages perhaps unmapped.
+static int
+shm_unmap(struct ShmAttach *a, bool unmap)
+{
+	struct Shm *s = a->sa_shm;
+	uint32_t i;
+	void *va;
+	int r;
+
+	for (i = 0; unmap && i < s->sh_npages; i++) {
+		va = (void *) (a->sa_va + i * PGSIZE);
+		if (page_lookup(a->sa_pgdir, va, NULL) == s->sh_pages[i]
+		    && (r = page_remove(a->sa_pgdir, va)) < 0)
+			return r;
+	}
+	a->sa_shm = NULL;
+	if (--s->sh_nattach == 0)
+		shm_free(s);
+	return 0;
+}
+
+//
+// Create a segment named 'name' of npages zeroed pages, charged to
+// e's resource group, and attach it to e at va with perm (see
+// shm_attach).
+//
+// Returns the segment's handle on success, < 0 on error.  Errors are:
+//	-E_INVAL if name is empty or npages is 0 or over SHM_MAXPAGES.
+//	-E_EXISTS if a segment has that name.
+//	-E_NO_MEM if every segment slot is in use, or on memory
+//		exhaustion.
+//	Any error from shm_attach, in which case nothing is created.
+//
+int
+shm_create(struct Env *e, const char *name, uint32_t npages, void *va,
+	   int perm)
+{
+	struct Shm *s, *free = NULL;
+	int r;
+
+	if (!name[0] || npages == 0 || npages > SHM_MAXPAGES)
+		return -E_INVAL;
+	for (s = shms; s < shms + NSHM; s++)
+		if (!s->sh_name[0])
+			free = free ? free : s;
+		else if (strcmp(s->sh_name, name) == 0)
+			return -E_EXISTS;
+	if (!(s = free))
+		return -E_NO_MEM;
+
+	strcpy(s->sh_name, name);
+	for (s->sh_npages = 0; s->sh_npages < npages; s->sh_npages++) {
+		if (!(s->sh_pages[s->sh_npages] =
+		      rgroup_page_alloc(e, ALLOC_ZERO))) {
+			shm_free(s);
+			return -E_NO_MEM;
+		}
+		s->sh_pages[s->sh_npages]->pp_ref++;
+	}
+	if ((r = shm_attach(e, shm_handle(s), va, perm)) < 0) {
+		shm_free(s);
+		return r;
+	}
+	return shm_handle(s);
+}
+
+//
+// Returns the handle of the segment named 'name', or -E_NOT_FOUND.
+//
+int
+shm_lookup(const char *name)
+{
+	struct Shm *s;
+
+	for (s = shms; s < shms + NSHM; s++)
+		if (s->sh_name[0] && strcmp(s->sh_name, name) == 0)
+			return shm_handle(s);
+	return -E_NOT_FOUND;
+}
+
+//
+// Map the pages of segment 'handle' into e's address space, from va
+// up, with perm, which the caller has checked.  Pages already mapped
+// there are unmapped.
+//
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_NOT_FOUND if handle does not name a segment.
+//	-E_INVAL if va is not page-aligned, or the segment would not fit
+//		below UTOP.
+//	-E_NO_MEM if every attachment slot is in use, or on memory
+//		exhaustion, in which case nothing is mapped.
+//
+int
+shm_attach(struct Env *e, int handle, void *va, int perm)
+{
+	struct ShmAttach *a;
+	struct Shm *s;
+	uint32_t i;
+	int r;
+
+	if (!(s = handle2shm(handle)))
+		return -E_NOT_FOUND;
+	if (PGOFF(va) || (uintptr_t) va > UTOP - s->sh_npages * PGSIZE)
+		return -E_INVAL;
+	for (a = shm_attaches; a < shm_attaches + NSHMATTACH; a++)
+		if (!a->sa_shm)
+			break;
+	if (a == shm_attaches + NSHMATTACH)
+		return -E_NO_MEM;
+
+	for (i = 0; i < s->sh_npages; i++)
+		if ((r = page_insert(e->env_pgdir, s->sh_pages[i],
+				     va + i * PGSIZE, perm | PTE_SHARE)) < 0) {
+			while (i-- > 0)
+				page_remove(e->env_pgdir, va + i * PGSIZE);
+			return r;
+		}
+	a->sa_shm = s;
+	a->sa_pgdir = e->env_pgdir;
+	a->sa_va = (uintptr_t) va;
+	s->sh_nattach++;
+	return 0;
+}
+
+//
+// Undo e's attachment of segment 'handle' at va, unmapping the pages
+// that still map the segment, and free the segment if that was its
+// last attachment.
+//
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_NOT_FOUND if there is no such attachment.
+//	-E_NO_MEM if a page table shared with a clone could not be
+//		unshared, in which case the attachment stays.
+//
+int
+shm_detach(struct Env *e, int handle, void *va)
+{
+	struct ShmAttach *a;
+	struct Shm *s;
+
+	if (!(s = handle2shm(handle)))
+		return -E_NOT_FOUND;
+	for (a = shm_attaches; a < shm_attaches + NSHMATTACH; a++)
+		if (a->sa_shm == s && a->sa_pgdir == e->env_pgdir
+		    && a->sa_va == (uintptr_t) va) {
+			return shm_unmap(a, 1);
+		}
+	return -E_NOT_FOUND;
+}
+
+//
+// Detach everything attached to address space pgdir, which is being
+// torn down.  The mappings are left to the teardown, which may only
+// drop its references to page tables shared with clones, where
+// page_remove() would have to unshare them first.
+//
+void
+shm_detach_pgdir(pde_t *pgdir)
+{
+	struct ShmAttach *a;
+
+	for (a = shm_attaches; a < shm_attaches + NSHMATTACH; a++)
+		if (a->sa_shm && a->sa_pgdir == pgdir)
+			shm_unmap(a, 0);
+}
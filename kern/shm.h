@@ -0,0 +1,47 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_SHM_H
+#define JOS_KERN_SHM_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+#include <inc/memlayout.h>
+#include <inc/shm.h>
+
+struct Env;
+struct PageInfo;
+
+#define NSHM		32	// Segments at once
+#define NSHMATTACH	256	// Attachments at once, over all segments
+
+// A shared-memory segment.  Each page holds a reference of the
+// segment's own besides its mappings, so a page outlives the segment
+// if it is still mapped, for instance by a clone that inherited it.
+struct Shm {
+	char sh_name[SHM_NAMELEN];	// Empty if this slot is free
+	uint32_t sh_gen;		// Bumped when the slot is freed
+	uint32_t sh_npages;
+	uint32_t sh_nattach;		// Attachments; freed at 0
+	struct PageInfo *sh_pages[SHM_MAXPAGES];
+};
+
+// One mapping of a segment's pages, from sa_va up, in one address space.
+struct ShmAttach {
+	struct Shm *sa_shm;		// NULL if this slot is free
+	pde_t *sa_pgdir;
+	uintptr_t sa_va;
+};
+
+extern struct Shm shms[NSHM];
+
+int	shm_handle(struct Shm *s);
+int	shm_create(struct Env *e, const char *name, uint32_t npages,
+		   void *va, int perm);
+int	shm_lookup(const char *name);
+int	shm_attach(struct Env *e, int handle, void *va, int perm);
+int	shm_detach(struct Env *e, int handle, void *va);
+void	shm_detach_pgdir(pde_t *pgdir);
+
+#endif	// !JOS_KERN_SHM_H
@@ -4,26 +4,54 @@
 #include <inc/error.h>
 #include <inc/string.h>
 #include <inc/assert.h>
+#include <inc/chan.h>
 
 #include <kern/env.h>
 #include <kern/pmap.h>
 #include <kern/trap.h>
 #include <kern/syscall.h>
 #include <kern/console.h>
+#include <kern/sched.h>
+#include <kern/rgroup.h>
+#include <kern/uring.h>
+#include <kern/futex.h>
+#include <kern/shm.h>
+
+// Set while syscall_batched() runs a call for sys_batch() or a ring.
+static bool batching;
+
+// Check that curenv may access [va, va+len) with permissions perm | PTE_U.
+// Returns 0 if it may.  If not, destroys curenv, as user_mem_assert
+// does, except in a batched call, which returns -E_FAULT instead.
+static int
+user_mem_require(const void *va, size_t len, int perm)
+{
+	if (!batching) {
+		user_mem_assert(curenv, va, len, perm);
+		return 0;
+	}
+	return user_mem_check(curenv, va, len, perm | PTE_U) < 0 ? -E_FAULT : 0;
+}
 
 // Print a string to the system console.
 // The string is exactly 'len' characters long.
-// Destroys the environment on memory errors.
-static void
+// Destroys the environment on memory errors, or returns -E_FAULT in a
+// batch.
+static int
 sys_cputs(const char *s, size_t len)
 {
+	int r;
+
 	// Check that the user has permission to read memory [s, s+len).
 	// Destroy the environment if not.
 
 	// LAB 3: Your code here.
+	if ((r = user_mem_require(s, len, PTE_U)) < 0)
+		return r;
 
 	// Print the string supplied by the user.
 	cprintf("%.*s", len, s);
+	return 0;
 }
 
 // Read a character from the system console without blocking.
@@ -62,6 +90,881 @@ sys_env_destroy(envid_t envid)
 	return 0;
 }
 
+// Deschedule current environment and pick a different one to run.
+static void
+sys_yield(void)
+{
+	sched_yield();
+}
+
+// Give the rest of this time slice to environment 'envid' if it is
+// waiting to run, without queueing behind other environments.
+// Otherwise just yield.
+static void
+sys_yield_to(envid_t envid)
+{
+	struct Env *e;
+
+	if (envid2env(envid, &e, 0) == 0 && e != curenv)
+		sched_yield_to(e);
+	sched_yield();
+}
+
+// Put environment 'envid' in the real-time class with a budget of
+// 'runtime' TSC cycles in every 'period', and each period's job due
+// within 'deadline' of the period's start; or take it out of the
+// class if runtime is 0 (see sched_rt_set).
+//
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_BAD_ENV if environment envid doesn't currently exist,
+//		or the caller doesn't have permission to change envid.
+//	-E_INVAL unless 0 < runtime <= deadline <= period.
+//	-E_OVERLOAD if admission control refuses envid, overall or
+//		against the real-time budget of envid's resource group.
+static int
+sys_env_set_rt(envid_t envid, uint32_t runtime, uint32_t period,
+	       uint32_t deadline)
+{
+	struct Env *e;
+	int r;
+
+	if ((r = envid2env(envid, &e, 1)) < 0)
+		return r;
+	if (e->env_type != ENV_TYPE_USER)
+		return -E_INVAL;
+	return sched_rt_set(e, runtime, period, deadline);
+}
+
+// End this period's job of a real-time environment and sleep until the
+// next period.  Returns the environment's total of missed deadlines,
+// or -E_INVAL if the caller is not in the real-time class.
+static int
+sys_rt_wait(void)
+{
+	int r;
+
+	if ((r = sched_rt_wait(curenv)) < 0)
+		return r;
+	curenv->env_tf.tf_regs.reg_eax = r;
+	sched_yield();
+}
+
+// Give the current environment a system call ring (see inc/uring.h)
+// in a new page mapped at va.
+//
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_INVAL if va >= UTOP, or va is not page-aligned.
+//	-E_INVAL if the environment already has a ring.
+//	-E_NO_MEM on memory exhaustion.
+static int
+sys_ring_setup(void *va)
+{
+	return uring_setup(curenv, va);
+}
+
+// Run the system calls queued on the current environment's ring.
+//
+// Returns the number of entries taken, or -E_INVAL if the
+// environment has no ring.
+static int
+sys_ring_enter(void)
+{
+	if (!env_cold(curenv)->env_ring)
+		return -E_INVAL;
+	return uring_drain(curenv);
+}
+
+// Allocate a new environment.
+// Returns envid of new environment, or < 0 on error.  Errors are:
+//	-E_NO_FREE_ENV if no free environment is available.
+//	-E_NO_MEM on memory exhaustion.
+static envid_t
+sys_exofork(void)
+{
+	// Create the new environment with env_alloc(), from kern/env.c.
+	// It should be left as env_alloc created it, except that
+	// status is set to ENV_NOT_RUNNABLE, and the register set is copied
+	// from the current environment -- but tweaked so sys_exofork
+	// will appear to return 0.
+	struct Env *e;
+	int r;
+
+	if ((r = env_alloc(&e, curenv->env_id)) < 0)
+		return r;
+	sched_dequeue(e);
+	e->env_status = ENV_NOT_RUNNABLE;
+	e->env_tf = curenv->env_tf;
+	e->env_tf.tf_regs.reg_eax = 0;
+	return e->env_id;
+}
+
+// Set envid's env_status to status, which must be ENV_RUNNABLE
+// or ENV_NOT_RUNNABLE.  If envid is blocked in sys_ipc_recv, the
+// receive fails with -E_IPC_NOT_RECV.
+//
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_BAD_ENV if environment envid doesn't currently exist,
+//		or the caller doesn't have permission to change envid.
+//	-E_INVAL if status is not a valid status for an environment,
+//		or envid is a template.
+static int
+sys_env_set_status(envid_t envid, int status)
+{
+	struct EnvCold *c;
+	struct Env *e;
+	int r;
+
+	if (status != ENV_RUNNABLE && status != ENV_NOT_RUNNABLE)
+		return -E_INVAL;
+	if ((r = envid2env(envid, &e, 1)) < 0)
+		return r;
+	if (e->env_type == ENV_TYPE_TEMPLATE)
+		return -E_INVAL;
+	c = env_cold(e);
+
+	// An env blocked receiving stops receiving, so that no sender
+	// can deliver to it, and run it, once it is queued here.  An env
+	// blocked on a futex stops waiting, so that a later wake cannot
+	// mistake whatever it blocks in next for the futex wait.
+	if (c->env_ipc_recving) {
+		c->env_ipc_recving = 0;
+		e->env_tf.tf_regs.reg_eax = -E_IPC_NOT_RECV;
+	}
+	futex_cancel(e);
+
+	// A running env keeps running; it just is not queued again when
+	// it gives up the CPU.  If it has not given it up yet, making it
+	// runnable again only undoes that: queueing it would let another
+	// CPU run it at the same time.  Otherwise keep the run queues in
+	// step.
+	if (e->env_status == ENV_RUNNING) {
+		if (status == ENV_NOT_RUNNABLE)
+			e->env_status = status;
+	} else if (status == ENV_RUNNABLE && env_on_cpu(e)) {
+		e->env_status = ENV_RUNNING;
+	} else if (e->env_status != status) {
+		e->env_status = status;
+		if (status == ENV_RUNNABLE)
+			sched_enqueue(e);
+		else
+			sched_dequeue(e);
+	}
+	return 0;
+}
+
+// Set the page fault upcall for 'envid' by modifying the corresponding
+// struct EnvCold's 'env_pgfault_upcall' field.  When 'envid' causes a page
+// fault, the kernel will push a fault record onto the exception stack
+// of envid's thread (see UTXSTACKTOP), then branch to 'func'.  Threads
+// that envid creates later inherit the upcall.
+//
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_BAD_ENV if environment envid doesn't currently exist,
+//		or the caller doesn't have permission to change envid.
+static int
+sys_env_set_pgfault_upcall(envid_t envid, void *func)
+{
+	struct Env *e;
+	int r;
+
+	if ((r = envid2env(envid, &e, 1)) < 0)
+		return r;
+	env_cold(e)->env_pgfault_upcall = func;
+	return 0;
+}
+
+// Capture the current environment as a template (see env_snapshot).
+// Envs cloned from it start as if returning 0 from this call.
+//
+// Returns the template's envid on success, < 0 on error.  Errors are:
+//	-E_INVAL if the environment has a system call ring.
+//	-E_NO_FREE_ENV if no free environment is available.
+//	-E_NO_MEM on memory exhaustion.
+static envid_t
+sys_env_snapshot(void)
+{
+	struct Env *t;
+	int r;
+
+	if ((r = env_snapshot(curenv, &t)) < 0)
+		return r;
+	return t->env_id;
+}
+
+// Start a new runnable child environment from template 'tmplid'.
+//
+// Returns the new envid on success, < 0 on error.  Errors are:
+//	-E_BAD_ENV if tmplid doesn't currently exist,
+//		or the caller doesn't have permission to change it.
+//	-E_INVAL if tmplid is not a template.
+//	-E_NO_FREE_ENV if no free environment is available.
+//	-E_NO_MEM on memory exhaustion.
+static envid_t
+sys_env_clone(envid_t tmplid)
+{
+	struct Env *t, *e;
+	int r;
+
+	if ((r = envid2env(tmplid, &t, 1)) < 0)
+		return r;
+	if (t->env_type != ENV_TYPE_TEMPLATE)
+		return -E_INVAL;
+	if ((r = env_clone(t, curenv->env_id, &e)) < 0)
+		return r;
+	return e->env_id;
+}
+
+// Start a new thread in the caller's address space, running
+// eip(arg) on its own stack and returning to 'ret' (see
+// env_thread_create).  Destroying a thread with sys_env_destroy
+// leaves the other threads running.
+//
+// Returns the new thread's envid on success, < 0 on error.  Errors are:
+//	-E_INVAL if eip or ret is not below UTOP.
+//	-E_NO_FREE_ENV if the address space has NTHREADS threads,
+//		or no free environment is available.
+//	-E_NO_MEM on memory exhaustion.
+static envid_t
+sys_thread_create(uintptr_t eip, uint32_t arg, uintptr_t ret)
+{
+	struct Env *e;
+	int r;
+
+	if (eip >= UTOP || ret >= UTOP)
+		return -E_INVAL;
+	if ((r = env_thread_create(curenv, eip, arg, ret, &e)) < 0)
+		return r;
+	return e->env_id;
+}
+
+// Create a subgroup of the caller's resource group with CPU weight
+// 'weight' and a limit of 'page_limit' pages, or no limit if it is 0.
+// The weight is taken from the caller's group's, which must keep at
+// least 1.  If the caller's group has a page limit, page_limit must be
+// nonzero and at most that limit, and the new group's pages count
+// against both.  The group's envs may be admitted to the real-time
+// class up to 'rt_limit' per mille of a CPU in all, which is taken
+// from the caller's group's real-time budget until sys_rgroup_destroy
+// gives it back.  No env is in the group until sys_env_set_rgroup puts
+// one there.
+//
+// Returns the group id on success, < 0 on error.  Errors are:
+//	-E_INVAL if weight or page_limit is out of range.
+//	-E_OVERLOAD if the caller's group has less than rt_limit of its
+//		real-time budget left.
+//	-E_NO_MEM if all NRGROUP groups exist.
+static int
+sys_rgroup_create(uint32_t weight, uint32_t page_limit, uint32_t rt_limit)
+{
+	return rgroup_create(curenv->env_rgroup, weight, page_limit,
+			     rt_limit);
+}
+
+// Move envid into resource group 'gid', which must be the caller's
+// group or one created under it.  Its future children start out in
+// the same group.
+//
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_BAD_ENV if environment envid doesn't currently exist,
+//		or the caller doesn't have permission to change envid.
+//	-E_INVAL if gid is not a group, or not below the caller's.
+static int
+sys_env_set_rgroup(envid_t envid, uint32_t gid)
+{
+	struct Env *e;
+	int r;
+
+	if ((r = envid2env(envid, &e, 1)) < 0)
+		return r;
+	if (!rgroup_live(gid) || !rgroup_within(gid, curenv->env_rgroup))
+		return -E_INVAL;
+	rgroup_join(e, gid);
+	return 0;
+}
+
+// Destroy resource group 'gid', which must have been created under the
+// caller's group, and give its weight and real-time budget back to the
+// group that created it.
+//
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_INVAL if gid is not a group below the caller's, or still has
+//		envs, subgroups or real-time envs.
+static int
+sys_rgroup_destroy(uint32_t gid)
+{
+	if (!rgroup_live(gid) || gid == curenv->env_rgroup
+	    || !rgroup_within(gid, curenv->env_rgroup))
+		return -E_INVAL;
+	return rgroup_destroy(gid);
+}
+
+// Create n runnable children of the caller running the built-in
+// program 'name' (see env_image), and write their envids to ids[].
+// Children after the first share the first's read-only pages.
+//
+// Returns the number of children created, which is less than n only
+// if the next one could not be created, or < 0 on error.  Errors are:
+//	-E_INVAL if there is no program called name, or n is 0.
+//	-E_NO_FREE_ENV if no free environment is available.
+//	-E_NO_MEM on memory exhaustion.
+// Destroys the caller if name or ids is not valid user memory.
+static int
+sys_env_spawn(const char *name, size_t len, uint32_t n, envid_t *ids)
+{
+	uint8_t *binary;
+
+	user_mem_assert(curenv, name, len, PTE_U);
+	if (n == 0 || n > NENV)
+		return -E_INVAL;
+	user_mem_assert(curenv, ids, n * sizeof(envid_t), PTE_U | PTE_W);
+	if (!(binary = env_image(name, len)))
+		return -E_INVAL;
+	return env_spawn(binary, curenv->env_id, n, ids);
+}
+
+// Return 0 if perm is a legal permission set for a user page:
+// PTE_U | PTE_P must be set, and nothing outside PTE_SYSCALL may be.
+static int
+check_perm(int perm)
+{
+	if ((perm & (PTE_U | PTE_P)) != (PTE_U | PTE_P)
+	    || (perm & ~PTE_SYSCALL))
+		return -E_INVAL;
+	return 0;
+}
+
+// Allocate a page of memory and map it at 'va' with permission
+// 'perm' in the address space of 'envid'.
+// The page's contents are set to 0.
+// If a page is already mapped at 'va', that page is unmapped as a
+// side effect.
+//
+// Return 0 on success, < 0 on error.  Errors are:
+//	-E_BAD_ENV if environment envid doesn't currently exist,
+//		or the caller doesn't have permission to change envid.
+//	-E_INVAL if va >= UTOP, or va is not page-aligned.
+//	-E_INVAL if perm is inappropriate (see check_perm).
+//	-E_NO_MEM if there's no memory to allocate the new page,
+//		or to allocate any necessary page tables,
+//		or envid's resource group is at its page limit.
+static int
+sys_page_alloc(envid_t envid, void *va, int perm)
+{
+	struct Env *e;
+	struct PageInfo *pp;
+	int r;
+
+	if ((r = envid2env(envid, &e, 1)) < 0)
+		return r;
+	if ((uintptr_t) va >= UTOP || PGOFF(va))
+		return -E_INVAL;
+	if ((r = check_perm(perm)) < 0)
+		return r;
+	if (!(pp = rgroup_page_alloc(e, ALLOC_ZERO)))
+		return -E_NO_MEM;
+	if ((r = page_insert(e->env_pgdir, pp, va, perm)) < 0) {
+		page_free(pp);
+		return r;
+	}
+	return 0;
+}
+
+// Map the page of memory at 'srcva' in srcenvid's address space
+// at 'dstva' in dstenvid's address space with permission 'perm'.
+// Perm has the same restrictions as in sys_page_alloc, except
+// that it also must not grant write access to a read-only page.
+//
+// Return 0 on success, < 0 on error.  Errors are:
+//	-E_BAD_ENV if srcenvid and/or dstenvid doesn't currently exist,
+//		or the caller doesn't have permission to change one of them.
+//	-E_INVAL if srcva >= UTOP or srcva is not page-aligned,
+//		or dstva >= UTOP or dstva is not page-aligned.
+//	-E_INVAL is srcva is not mapped in srcenvid's address space.
+//	-E_INVAL if perm is inappropriate (see sys_page_alloc).
+//	-E_INVAL if (perm & PTE_W), but srcva is read-only in srcenvid's
+//		address space.
+//	-E_NO_MEM if there's no memory to allocate any necessary page tables.
+static int
+sys_page_map(envid_t srcenvid, void *srcva,
+	     envid_t dstenvid, void *dstva, int perm)
+{
+	struct Env *src, *dst;
+	struct PageInfo *pp;
+	pte_t *pte;
+	int r;
+
+	if ((r = envid2env(srcenvid, &src, 1)) < 0
+	    || (r = envid2env(dstenvid, &dst, 1)) < 0)
+		return r;
+	if ((uintptr_t) srcva >= UTOP || PGOFF(srcva)
+	    || (uintptr_t) dstva >= UTOP || PGOFF(dstva))
+		return -E_INVAL;
+	if ((r = check_perm(perm)) < 0)
+		return r;
+	if (!(pp = page_lookup(src->env_pgdir, srcva, &pte)))
+		return -E_INVAL;
+	if ((perm & PTE_W) && !(*pte & PTE_W))
+		return -E_INVAL;
+	return page_insert(dst->env_pgdir, pp, dstva, perm);
+}
+
+// Unmap the page of memory at 'va' in the address space of 'envid'.
+// If no page is mapped, the function silently succeeds.
+//
+// Return 0 on success, < 0 on error.  Errors are:
+//	-E_BAD_ENV if environment envid doesn't currently exist,
+//		or the caller doesn't have permission to change envid.
+//	-E_INVAL if va >= UTOP, or va is not page-aligned.
+//	-E_NO_MEM if there's no memory to unshare the page table
+//		covering va (see env_clone).
+static int
+sys_page_unmap(envid_t envid, void *va)
+{
+	struct Env *e;
+	int r;
+
+	if ((r = envid2env(envid, &e, 1)) < 0)
+		return r;
+	if ((uintptr_t) va >= UTOP || PGOFF(va))
+		return -E_INVAL;
+	return page_remove(e->env_pgdir, va);
+}
+
+// Deliver a message from the current environment to e, which is
+// blocked in sys_ipc_recv, and clear e's env_ipc_recving.  The message
+// is 'value' and, if srcva < UTOP, the page mapped at srcva.  The page
+// is not copied: the physical page is mapped at e's env_ipc_dstva with
+// permission 'perm', unless e asked for no page.  The message goes to
+// e in registers (see sys_ipc_recv), not through struct Env.
+//
+// Returns 0 on success, < 0 on error, in which case e still waits.
+// Errors are:
+//	-E_INVAL if srcva < UTOP but srcva is not page-aligned.
+//	-E_INVAL if srcva < UTOP and perm is inappropriate
+//		(see sys_page_alloc).
+//	-E_INVAL if srcva < UTOP but srcva is not mapped in the caller's
+//		address space.
+//	-E_INVAL if (perm & PTE_W), but srcva is read-only in the
+//		current environment's address space.
+//	-E_NO_MEM if there's not enough memory to map srcva in e's
+//		address space.
+static int
+ipc_deliver(struct Env *e, uint32_t value, void *srcva, int perm)
+{
+	struct EnvCold *c = env_cold(e);
+	struct PageInfo *pp = NULL;
+	pte_t *pte;
+	int r;
+
+	if ((uintptr_t) srcva < UTOP) {
+		if (PGOFF(srcva) || (r = check_perm(perm)) < 0)
+			return -E_INVAL;
+		if (!(pp = page_lookup(curenv->env_pgdir, srcva, &pte)))
+			return -E_INVAL;
+		if ((perm & PTE_W) && !(*pte & PTE_W))
+			return -E_INVAL;
+	}
+	if (pp && (uintptr_t) c->env_ipc_dstva < UTOP) {
+		if ((r = page_insert(e->env_pgdir, pp, c->env_ipc_dstva,
+				     perm)) < 0)
+			return r;
+	} else
+		perm = 0;
+
+	c->env_ipc_recving = 0;
+	e->env_tf.tf_regs.reg_eax = curenv->env_id;
+	e->env_tf.tf_regs.reg_ebx = value;
+	e->env_tf.tf_regs.reg_edi = perm;
+	return 0;
+}
+
+// Look up envid as the target of a send, which must be blocked
+// receiving: not queued or running anywhere, so that the sender can
+// rewrite its registers and run it.
+//
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_BAD_ENV if environment envid doesn't currently exist.
+//	-E_IPC_NOT_RECV if envid is not blocked in sys_ipc_recv.
+static int
+ipc_target(envid_t envid, struct Env **e_store)
+{
+	struct Env *e;
+	int r;
+
+	if ((r = envid2env(envid, &e, 0)) < 0)
+		return r;
+	if (!env_cold(e)->env_ipc_recving || e->env_status != ENV_NOT_RUNNABLE)
+		return -E_IPC_NOT_RECV;
+	*e_store = e;
+	return 0;
+}
+
+// Try to send 'value', and the page at 'srcva' if srcva < UTOP, to
+// the target env 'envid' (see ipc_deliver).  The send fails with
+// -E_IPC_NOT_RECV unless the target is blocked in sys_ipc_recv or
+// sys_ipc_call.  On success the target runs at once on this CPU,
+// without a pass through the scheduler, and the caller sees 0 when
+// it next runs.
+//
+// Returns < 0 on error.  Errors are:
+//	-E_BAD_ENV if environment envid doesn't currently exist.
+//		(No need to check permissions.)
+//	-E_IPC_NOT_RECV if envid is not currently blocked in
+//		sys_ipc_recv, or another environment managed to send
+//		first.
+//	Any error from ipc_deliver.
+static int
+sys_ipc_try_send(envid_t envid, uint32_t value, void *srcva, int perm)
+{
+	struct Env *e;
+	int r;
+
+	if ((r = ipc_target(envid, &e)) < 0)
+		return r;
+	if ((r = ipc_deliver(e, value, srcva, perm)) < 0)
+		return r;
+	curenv->env_tf.tf_regs.reg_eax = 0;
+	sched_ipc_switch(e);
+}
+
+// Mark the current environment blocked receiving, with any page to
+// go at dstva.
+static void
+ipc_wait(void *dstva)
+{
+	struct EnvCold *c = env_cold(curenv);
+
+	c->env_ipc_recving = 1;
+	c->env_ipc_dstva = dstva;
+	curenv->env_status = ENV_NOT_RUNNABLE;
+}
+
+// Block until a message arrives.  If 'dstva' is < UTOP, then a page
+// sent with the message is mapped there, replacing any page already
+// mapped; if dstva >= UTOP, no page is taken.
+//
+// The message comes back in registers: the call returns the sender's
+// envid, with the value in ebx and the permissions of the page mapped
+// at dstva in edi, or 0 if no page was.
+//
+// Returns < 0 on error.  Errors are:
+//	-E_INVAL if dstva < UTOP but dstva is not page-aligned.
+//	-E_IPC_NOT_RECV if sys_env_set_status ended the wait.
+static int
+sys_ipc_recv(void *dstva)
+{
+	if ((uintptr_t) dstva < UTOP && PGOFF(dstva))
+		return -E_INVAL;
+	ipc_wait(dstva);
+	sched_yield();
+}
+
+// Send to 'envid' like sys_ipc_try_send, then wait for the reply like
+// sys_ipc_recv(pg), with no return to user mode in between: the
+// target runs at once, and can answer with its own sys_ipc_call to
+// send the reply and wait for the next request.  The page at pg goes
+// with the message if perm is nonzero; either way a page in the reply
+// is mapped at pg.
+//
+// Returns as sys_ipc_recv.  Errors are:
+//	-E_INVAL if pg < UTOP but pg is not page-aligned.
+//	Any error from sys_ipc_try_send.
+static int
+sys_ipc_call(envid_t envid, uint32_t value, void *pg, int perm)
+{
+	struct Env *e;
+	int r;
+
+	if ((uintptr_t) pg < UTOP && PGOFF(pg))
+		return -E_INVAL;
+	if ((r = ipc_target(envid, &e)) < 0)
+		return r;
+	if ((r = ipc_deliver(e, value, perm ? pg : (void *) UTOP, perm)) < 0)
+		return r;
+	ipc_wait(pg);
+	sched_ipc_switch(e);
+}
+
+// Block until woken by sys_futex_wake on addr, if the word at addr
+// still holds val (see kern/futex.c).  If timeout is nonzero, give up
+// after that many microseconds.
+//
+// Returns 0 once woken, < 0 on error.  Errors are:
+//	-E_INVAL if addr >= UTOP, is not 4-byte aligned, or is not mapped.
+//	-E_NO_MEM if there's no memory to copy a copy-on-write page.
+//	-E_AGAIN if the word at addr does not hold val.
+//	-E_TIMEOUT if the timeout passed first.
+static int
+sys_futex_wait(uint32_t *addr, uint32_t val, uint32_t timeout)
+{
+	int r;
+
+	if ((r = futex_wait(curenv, addr, val, timeout)) < 0)
+		return r;
+	sched_yield();
+}
+
+// Wake up to n environments blocked in sys_futex_wait on the word at
+// addr, which may be mapped at a different address in theirs.
+//
+// Returns the number woken, or < 0 on error.  Errors are:
+//	-E_INVAL if addr >= UTOP, is not 4-byte aligned, or is not mapped.
+//	-E_NO_MEM if there's no memory to copy a copy-on-write page.
+static int
+sys_futex_wake(uint32_t *addr, uint32_t n)
+{
+	return futex_wake(curenv, addr, n);
+}
+
+// Set up a channel (see inc/chan.h) shared by the current environment
+// and 'peer': a header page and then npages pages of ring, all
+// zeroed but for ch_size, mapped read-write at va here and at peerva
+// in peer.  The pages count against the caller's resource group, and
+// are mapped PTE_SHARE so that forks keep them shared.
+//
+// Returns 0 on success, < 0 on error, in which case nothing is
+// mapped.  Errors are:
+//	-E_BAD_ENV if environment peer doesn't currently exist,
+//		or the caller doesn't have permission to change peer.
+//	-E_INVAL if npages is 0, not a power of two or more than
+//		CHAN_MAXPAGES.
+//	-E_INVAL if va or peerva is not page-aligned, or the channel
+//		would not fit below UTOP at either.
+//	-E_NO_MEM on memory exhaustion, or if the caller's resource
+//		group is at its page limit.
+static int
+sys_chan_create(envid_t peerid, void *va, void *peerva, uint32_t npages)
+{
+	const int perm = PTE_P | PTE_U | PTE_W | PTE_SHARE;
+	struct Env *peer;
+	struct PageInfo *pp;
+	uint32_t i;
+	int r;
+
+	if ((r = envid2env(peerid, &peer, 1)) < 0)
+		return r;
+	if (npages == 0 || (npages & (npages - 1)) || npages > CHAN_MAXPAGES)
+		return -E_INVAL;
+	if (PGOFF(va) || (uintptr_t) va > UTOP - (npages + 1) * PGSIZE
+	    || PGOFF(peerva)
+	    || (uintptr_t) peerva > UTOP - (npages + 1) * PGSIZE)
+		return -E_INVAL;
+
+	for (i = 0; i <= npages; i++) {
+		r = -E_NO_MEM;
+		if (!(pp = rgroup_page_alloc(curenv, ALLOC_ZERO)))
+			goto fail;
+		if ((r = page_insert(curenv->env_pgdir, pp,
+				     va + i * PGSIZE, perm)) < 0) {
+			page_free(pp);
+			goto fail;
+		}
+		if ((r = page_insert(peer->env_pgdir, pp,
+				     peerva + i * PGSIZE, perm)) < 0) {
+			page_remove(curenv->env_pgdir, va + i * PGSIZE);
+			goto fail;
+		}
+		if (i == 0)
+			((struct ChanHdr *) page2kva(pp))->ch_size =
+				npages * PGSIZE;
+	}
+	return 0;
+
+fail:
+	while (i-- > 0) {
+		page_remove(curenv->env_pgdir, va + i * PGSIZE);
+		page_remove(peer->env_pgdir, peerva + i * PGSIZE);
+	}
+	return r;
+}
+
+// Copy the segment name at user address name, len bytes long, into
+// buf as a NUL-terminated string.
+// Returns 0 on success, -E_INVAL if the name is empty or too long.
+// Destroys the caller if name is not valid user memory, or returns
+// -E_FAULT in a batch.
+static int
+shm_name(char buf[SHM_NAMELEN], const char *name, size_t len)
+{
+	int r;
+
+	if ((r = user_mem_require(name, len, PTE_U)) < 0)
+		return r;
+	if (len == 0 || len >= SHM_NAMELEN)
+		return -E_INVAL;
+	memcpy(buf, name, len);
+	buf[len] = '\0';
+	return strlen(buf) == len ? 0 : -E_INVAL;
+}
+
+// Create a shared-memory segment of npages zeroed pages called name,
+// and attach it to the caller at va with permission perm, as in
+// sys_shm_attach.  The pages are charged to the caller's resource
+// group, and freed when the segment's last attachment is detached.
+//
+// Returns the segment's handle on success, < 0 on error.  Errors are:
+//	-E_INVAL if name is empty, holds a NUL or is SHM_NAMELEN bytes
+//		or longer.
+//	-E_INVAL if npages is 0 or more than SHM_MAXPAGES.
+//	-E_INVAL if va is not page-aligned, or the segment would not fit
+//		below UTOP, or perm is inappropriate (see sys_page_alloc).
+//	-E_EXISTS if a segment called name exists.
+//	-E_NO_MEM if there is no room for another segment, or on memory
+//		exhaustion.
+// Destroys the caller if name is not valid user memory (see shm_name).
+static int
+sys_shm_create(const char *name, size_t len, uint32_t npages, void *va,
+	       int perm)
+{
+	char buf[SHM_NAMELEN];
+	int r;
+
+	if ((r = shm_name(buf, name, len)) < 0)
+		return r;
+	if (check_perm(perm) < 0)
+		return -E_INVAL;
+	return shm_create(curenv, buf, npages, va, perm);
+}
+
+// Return the handle of the shared-memory segment called name.
+//
+// Errors are:
+//	-E_INVAL if name is empty, holds a NUL or is too long.
+//	-E_NOT_FOUND if there is no segment called name.
+// Destroys the caller if name is not valid user memory (see shm_name).
+static int
+sys_shm_lookup(const char *name, size_t len)
+{
+	char buf[SHM_NAMELEN];
+	int r;
+
+	if ((r = shm_name(buf, name, len)) < 0)
+		return r;
+	return shm_lookup(buf);
+}
+
+// Map the pages of shared-memory segment 'handle' into the caller's
+// address space from va up, with permission perm.  Pages already
+// mapped there are unmapped.  The segment stays alive until every
+// attachment is detached with sys_shm_detach, or its address space is
+// destroyed.  The mappings are shared, not copied, by sys_env_snapshot.
+//
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_NOT_FOUND if handle is not a live segment's handle.
+//	-E_INVAL if va is not page-aligned, or the segment would not fit
+//		below UTOP, or perm is inappropriate (see sys_page_alloc).
+//	-E_NO_MEM if there is no room for another attachment, or on
+//		memory exhaustion.
+static int
+sys_shm_attach(int handle, void *va, int perm)
+{
+	if (check_perm(perm) < 0)
+		return -E_INVAL;
+	return shm_attach(curenv, handle, va, perm);
+}
+
+// Undo the caller's attachment of segment 'handle' at va, unmapping
+// those of its pages still mapped there.  Frees the segment if that
+// was its last attachment.
+//
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_NOT_FOUND if there is no such attachment.
+//	-E_NO_MEM if there's no memory to unshare a page table.
+static int
+sys_shm_detach(int handle, void *va)
+{
+	return shm_detach(curenv, handle, va);
+}
+
+// Run the system calls in v[0..n-1] in order, stopping after the
+// first one that fails.  Each entry's result goes in its sd_ret.
+// v is checked and copied in once, before anything runs, and the
+// results are copied back at the end.
+//
+// Returns the number of entries that succeeded, so n if all did and
+// otherwise the index of the entry that failed.  Errors, before any
+// entry runs, are:
+//	-E_INVAL if n < 0 or n > SYS_BATCH_MAX.
+//	-E_INVAL if an entry's call cannot be batched (see
+//		syscall_batchable).
+// Returns -E_FAULT if the entries ran but an entry unmapped v.
+// Destroys the caller if v is not valid user memory.
+static int
+sys_batch(struct SyscallDesc *v, int n)
+{
+	struct SyscallDesc d[SYS_BATCH_MAX];
+	int i;
+
+	if (n < 0 || n > SYS_BATCH_MAX)
+		return -E_INVAL;
+	user_mem_assert(curenv, v, n * sizeof(*v), PTE_U | PTE_W);
+	memcpy(d, v, n * sizeof(*v));
+	for (i = 0; i < n; i++)
+		if (!syscall_batchable(d[i].sd_num))
+			return -E_INVAL;
+
+	for (i = 0; i < n; i++)
+		if ((d[i].sd_ret = syscall_batched(d[i].sd_num,
+						   d[i].sd_args)) < 0)
+			break;
+
+	if (user_mem_check(curenv, v, n * sizeof(*v), PTE_U | PTE_W) < 0)
+		return -E_FAULT;
+	memcpy(v, d, MIN(i + 1, n) * sizeof(*v));
+	return i;
+}
+
+// Whether system call num may run from sys_batch() or a system call
+// ring, which may be polled from a timer interrupt: it must return to
+// its caller rather than block, switch envs or destroy the caller,
+// must not depend on the caller's trap frame, and must not run queued
+// calls itself.  Calls that check user memory do it with
+// user_mem_require(), which fails with -E_FAULT in a batch rather than
+// destroying the caller.  New calls are not batchable until added here.
+bool
+syscall_batchable(uint32_t num)
+{
+	switch (num) {
+	case SYS_cputs:
+	case SYS_cgetc:
+	case SYS_getenvid:
+	case SYS_page_alloc:
+	case SYS_page_map:
+	case SYS_page_unmap:
+	case SYS_env_set_status:
+	case SYS_env_set_pgfault_upcall:
+	case SYS_rgroup_create:
+	case SYS_env_set_rgroup:
+	case SYS_env_set_rt:
+	case SYS_futex_wake:
+	case SYS_chan_create:
+	case SYS_shm_create:
+	case SYS_shm_lookup:
+	case SYS_shm_attach:
+	case SYS_shm_detach:
+	case SYS_rgroup_destroy:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+// Run system call num with arguments args[0..4] for sys_batch() or a
+// system call ring.  Returns its result, or -E_INVAL if num is not
+// batchable.
+int32_t
+syscall_batched(uint32_t num, const uint32_t args[5])
+{
+	int32_t r;
+
+	if (!syscall_batchable(num))
+		return -E_INVAL;
+	batching = 1;
+	r = syscall(num, args[0], args[1], args[2], args[3], args[4]);
+	batching = 0;
+	return r;
+}
+
 // Dispatches to the correct kernel function, passing the arguments.
 int32_t
 syscall(uint32_t syscallno, uint32_t a1, uint32_t a2, uint32_t a3, uint32_t a4, uint32_t a5)
@@ -70,9 +973,77 @@ syscall(uint32_t syscallno, uint32_t a1, uint32_t a2, uint32_t a3, uint32_t a4,
 	// Return any appropriate return value.
 	// LAB 3: Your code here.
 
-	panic("syscall not implemented");
-
 	switch (syscallno) {
+	case SYS_cputs:
+		return sys_cputs((const char *) a1, a2);
+	case SYS_cgetc:
+		return sys_cgetc();
+	case SYS_getenvid:
+		return sys_getenvid();
+	case SYS_env_destroy:
+		return sys_env_destroy(a1);
+	case SYS_yield:
+		sys_yield();
+		return 0;
+	case SYS_page_alloc:
+		return sys_page_alloc(a1, (void *) a2, a3);
+	case SYS_page_map:
+		return sys_page_map(a1, (void *) a2, a3, (void *) a4, a5);
+	case SYS_page_unmap:
+		return sys_page_unmap(a1, (void *) a2);
+	case SYS_exofork:
+		return sys_exofork();
+	case SYS_env_set_status:
+		return sys_env_set_status(a1, a2);
+	case SYS_env_set_pgfault_upcall:
+		return sys_env_set_pgfault_upcall(a1, (void *) a2);
+	case SYS_env_snapshot:
+		return sys_env_snapshot();
+	case SYS_env_clone:
+		return sys_env_clone(a1);
+	case SYS_thread_create:
+		return sys_thread_create(a1, a2, a3);
+	case SYS_rgroup_create:
+		return sys_rgroup_create(a1, a2, a3);
+	case SYS_env_set_rgroup:
+		return sys_env_set_rgroup(a1, a2);
+	case SYS_rgroup_destroy:
+		return sys_rgroup_destroy(a1);
+	case SYS_env_spawn:
+		return sys_env_spawn((const char *) a1, a2, a3, (envid_t *) a4);
+	case SYS_yield_to:
+		sys_yield_to(a1);
+		return 0;
+	case SYS_env_set_rt:
+		return sys_env_set_rt(a1, a2, a3, a4);
+	case SYS_rt_wait:
+		return sys_rt_wait();
+	case SYS_ring_setup:
+		return sys_ring_setup((void *) a1);
+	case SYS_ring_enter:
+		return sys_ring_enter();
+	case SYS_batch:
+		return sys_batch((struct SyscallDesc *) a1, a2);
+	case SYS_ipc_try_send:
+		return sys_ipc_try_send(a1, a2, (void *) a3, a4);
+	case SYS_ipc_recv:
+		return sys_ipc_recv((void *) a1);
+	case SYS_ipc_call:
+		return sys_ipc_call(a1, a2, (void *) a3, a4);
+	case SYS_futex_wait:
+		return sys_futex_wait((uint32_t *) a1, a2, a3);
+	case SYS_futex_wake:
+		return sys_futex_wake((uint32_t *) a1, a2);
+	case SYS_chan_create:
+		return sys_chan_create(a1, (void *) a2, (void *) a3, a4);
+	case SYS_shm_create:
+		return sys_shm_create((const char *) a1, a2, a3, (void *) a4, a5);
+	case SYS_shm_lookup:
+		return sys_shm_lookup((const char *) a1, a2);
+	case SYS_shm_attach:
+		return sys_shm_attach(a1, (void *) a2, a3);
+	case SYS_shm_detach:
+		return sys_shm_detach(a1, (void *) a2);
 	default:
 		return -E_INVAL;
 	}
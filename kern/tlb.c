@@ -0,0 +1,141 @@
+// Cross-CPU TLB shootdown.
+//
+// A CPU caches translations only for the page directory in its CR3,
+// so when the kernel changes a pgdir it only has to tell the other
+// CPUs that have that pgdir loaded.  The exception is kern_pgdir:
+// its page tables above UTOP are shared by every page directory, so
+// a change to it goes to every CPU.  Each CPU records its pgdir in
+// cpu_pgdir (see tlb_switch).  tlb_invalidate() flushes the local TLB
+// at once and queues the address here; tlb_flush() then sends the
+// whole batch with one IPI per CPU that needs it, and waits until
+// every one of them has acknowledged.
+//
+// Only the holder of the big kernel lock changes page tables, so there
+// is a single batch and it is protected by that lock.  The batch is
+// flushed before the lock is released (env_run, sched_halt) and before
+// page_alloc() hands out a page, so a page freed by an unmap cannot be
+// reused while another CPU may still reach it through a stale entry.
+
+#include <inc/x86.h>
+#include <inc/assert.h>
+#include <inc/trap.h>
+
+#include <kern/tlb.h>
+#include <kern/cpu.h>
+#include <kern/pmap.h>
+
+struct TlbStats tlb_stats;
+
+static struct {
+	pde_t *pgdir;			// Address space being changed
+	int n;				// Addresses queued in va[]
+	bool full;			// Too many; flush everything
+	uintptr_t va[TLB_BATCH_MAX];
+	volatile uint32_t pending;	// CPUs that have yet to flush
+} batch;
+
+// Load pgdir into this CPU's CR3 and record that it is loaded here.
+void
+tlb_switch(pde_t *pgdir)
+{
+	this_cpu_write(cpu_pgdir, pgdir);
+	lcr3(PADDR(pgdir));
+}
+
+// Return a mask of the CPUs other than this one that have pgdir loaded,
+// or that have any loaded if pgdir is kern_pgdir.
+static uint32_t
+tlb_cpus(pde_t *pgdir)
+{
+	uint32_t mask = 0;
+	int i;
+
+	for (i = 0; i < ncpu; i++)
+		if ((cpus[i].cpu_pgdir == pgdir
+		     || (pgdir == kern_pgdir && cpus[i].cpu_pgdir))
+		    && &cpus[i] != thiscpu)
+			mask |= 1 << i;
+	return mask;
+}
+
+//
+// Queue va in pgdir for invalidation on the other CPUs.
+// The caller has already flushed its own TLB.
+//
+void
+tlb_shootdown(pde_t *pgdir, void *va)
+{
+	tlb_stats.ts_invalidations++;
+	if (!tlb_cpus(pgdir))
+		return;
+
+	if (batch.pgdir != pgdir) {
+		tlb_flush();
+		batch.pgdir = pgdir;
+	}
+	if (batch.n < TLB_BATCH_MAX)
+		batch.va[batch.n++] = (uintptr_t) va;
+	else
+		batch.full = 1;
+	tlb_stats.ts_queued++;
+}
+
+//
+// Send the queued batch to every other CPU that has its pgdir loaded
+// and wait for them all to flush.  CPUs that switched away from the
+// pgdir since it was queued already dropped the stale entries when
+// they reloaded CR3.
+//
+void
+tlb_flush(void)
+{
+	uint32_t mask;
+	int i;
+
+	if (!batch.n)
+		return;
+
+	if ((mask = tlb_cpus(batch.pgdir))) {
+		// Publish the batch before any CPU can see itself pending.
+		asm volatile("" : : : "memory");
+		batch.pending = mask;
+		for (i = 0; i < ncpu; i++)
+			if (mask & (1 << i)) {
+				lapic_ipi_cpu(cpus[i].cpu_id, T_TLBFLUSH);
+				tlb_stats.ts_ipis++;
+			}
+		while (batch.pending)
+			asm volatile("pause");
+		tlb_stats.ts_batches++;
+		if (batch.full)
+			tlb_stats.ts_full++;
+	}
+
+	batch.pgdir = NULL;
+	batch.n = 0;
+	batch.full = 0;
+}
+
+//
+// Carry out this CPU's part of a pending shootdown, if any.
+// Called from the T_TLBFLUSH handler, and by CPUs spinning for the
+// big kernel lock with interrupts disabled, since the lock holder may
+// be waiting for them.
+//
+void
+tlb_poll(void)
+{
+	uint32_t bit = 1 << (thiscpu - cpus);
+	int i;
+
+	if (!(batch.pending & bit))
+		return;
+
+	if (batch.full)
+		lcr3(rcr3());
+	else
+		for (i = 0; i < batch.n; i++)
+			invlpg((void *) batch.va[i]);
+	asm volatile("lock; andl %1, %0"
+		     : "+m" (batch.pending) : "r" (~bit) : "memory");
+}
@@ -0,0 +1,32 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_TLB_H
+#define JOS_KERN_TLB_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+#include <inc/memlayout.h>
+
+// A batch holding more than this many addresses is sent as a full
+// flush instead: reloading CR3 beats a long run of invlpgs.
+#define TLB_BATCH_MAX	32
+
+// Shootdown counters, reported by the 'tlb' monitor command.
+struct TlbStats {
+	uint32_t ts_invalidations;	// tlb_invalidate() calls
+	uint32_t ts_queued;		// ... that other CPUs had to see
+	uint32_t ts_batches;		// Batches sent
+	uint32_t ts_full;		// ... as full flushes
+	uint32_t ts_ipis;		// Shootdown IPIs sent
+};
+
+extern struct TlbStats tlb_stats;
+
+void tlb_switch(pde_t *pgdir);
+void tlb_shootdown(pde_t *pgdir, void *va);
+void tlb_flush(void);
+void tlb_poll(void);
+
+#endif	// !JOS_KERN_TLB_H
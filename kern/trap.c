@@ -8,8 +8,15 @@
 #include <kern/monitor.h>
 #include <kern/env.h>
 #include <kern/syscall.h>
-
-static struct Taskstate ts;
+#include <kern/sched.h>
+#include <kern/kclock.h>
+#include <kern/picirq.h>
+#include <kern/cpu.h>
+#include <kern/spinlock.h>
+#include <kern/tlb.h>
+#include <kern/rgroup.h>
+#include <kern/uring.h>
+#include <kern/futex.h>
 
 /* For debugging, so print_trapframe can distinguish between printing
  * a saved trapframe and printing the current trapframe and print some
@@ -55,6 +62,10 @@ static const char *trapname(int trapno)
 		return excnames[trapno];
 	if (trapno == T_SYSCALL)
 		return "System call";
+	if (trapno == T_TLBFLUSH)
+		return "TLB shootdown";
+	if (trapno >= IRQ_OFFSET && trapno < IRQ_OFFSET + 16)
+		return "Hardware Interrupt";
 	return "(unknown trap)";
 }
 
@@ -65,6 +76,47 @@ trap_init(void)
 	extern struct Segdesc gdt[];
 
 	// LAB 3: Your code here.
+	void th_divide(), th_debug(), th_nmi(), th_brkpt(), th_oflow();
+	void th_bound(), th_illop(), th_device(), th_dblflt(), th_tss();
+	void th_segnp(), th_stack(), th_gpflt(), th_pgflt(), th_fperr();
+	void th_align(), th_mchk(), th_simderr(), th_syscall(), th_tlbflush();
+	void th_irq0(), th_irq1(), th_irq2(), th_irq3(), th_irq4();
+	void th_irq5(), th_irq6(), th_irq7(), th_irq8(), th_irq9();
+	void th_irq10(), th_irq11(), th_irq12(), th_irq13(), th_irq14();
+	void th_irq15(), th_irq_error();
+	static void (*const irq_handlers[16])() = {
+		th_irq0, th_irq1, th_irq2, th_irq3, th_irq4, th_irq5,
+		th_irq6, th_irq7, th_irq8, th_irq9, th_irq10, th_irq11,
+		th_irq12, th_irq13, th_irq14, th_irq15
+	};
+	int i;
+
+	// All gates are interrupt gates, so the kernel always runs
+	// with interrupts disabled.  Only the breakpoint and system
+	// call vectors may be raised from user mode with 'int'.
+	SETGATE(idt[T_DIVIDE], 0, GD_KT, th_divide, 0);
+	SETGATE(idt[T_DEBUG], 0, GD_KT, th_debug, 0);
+	SETGATE(idt[T_NMI], 0, GD_KT, th_nmi, 0);
+	SETGATE(idt[T_BRKPT], 0, GD_KT, th_brkpt, 3);
+	SETGATE(idt[T_OFLOW], 0, GD_KT, th_oflow, 0);
+	SETGATE(idt[T_BOUND], 0, GD_KT, th_bound, 0);
+	SETGATE(idt[T_ILLOP], 0, GD_KT, th_illop, 0);
+	SETGATE(idt[T_DEVICE], 0, GD_KT, th_device, 0);
+	SETGATE(idt[T_DBLFLT], 0, GD_KT, th_dblflt, 0);
+	SETGATE(idt[T_TSS], 0, GD_KT, th_tss, 0);
+	SETGATE(idt[T_SEGNP], 0, GD_KT, th_segnp, 0);
+	SETGATE(idt[T_STACK], 0, GD_KT, th_stack, 0);
+	SETGATE(idt[T_GPFLT], 0, GD_KT, th_gpflt, 0);
+	SETGATE(idt[T_PGFLT], 0, GD_KT, th_pgflt, 0);
+	SETGATE(idt[T_FPERR], 0, GD_KT, th_fperr, 0);
+	SETGATE(idt[T_ALIGN], 0, GD_KT, th_align, 0);
+	SETGATE(idt[T_MCHK], 0, GD_KT, th_mchk, 0);
+	SETGATE(idt[T_SIMDERR], 0, GD_KT, th_simderr, 0);
+	SETGATE(idt[T_SYSCALL], 0, GD_KT, th_syscall, 3);
+	for (i = 0; i < 16; i++)
+		SETGATE(idt[IRQ_OFFSET + i], 0, GD_KT, irq_handlers[i], 0);
+	SETGATE(idt[IRQ_OFFSET + IRQ_ERROR], 0, GD_KT, th_irq_error, 0);
+	SETGATE(idt[T_TLBFLUSH], 0, GD_KT, th_tlbflush, 0);
 
 	// Per-CPU setup 
 	trap_init_percpu();
@@ -74,29 +126,42 @@ trap_init(void)
 void
 trap_init_percpu(void)
 {
+	// Each CPU has its own TSS, pointing at its own kernel stack
+	// (see mem_init_mp), and its own TSS descriptor in the GDT.
+	int i = cpunum();
+
 	// Setup a TSS so that we get the right stack
 	// when we trap to the kernel.
-	ts.ts_esp0 = KSTACKTOP;
-	ts.ts_ss0 = GD_KD;
-	ts.ts_iomb = sizeof(struct Taskstate);
+	// env_run() points ts_esp0 at each env's save area in turn.
+	thiscpu->cpu_ts.ts_esp0 = KSTACKTOP_CPU(i);
+	thiscpu->cpu_ts.ts_ss0 = GD_KD;
+	thiscpu->cpu_ts.ts_iomb = sizeof(struct Taskstate);
 
 	// Initialize the TSS slot of the gdt.
-	gdt[GD_TSS0 >> 3] = SEG16(STS_T32A, (uint32_t) (&ts),
+	gdt[(GD_TSS0 >> 3) + i] = SEG16(STS_T32A, (uint32_t) (&thiscpu->cpu_ts),
 					sizeof(struct Taskstate) - 1, 0);
-	gdt[GD_TSS0 >> 3].sd_s = 0;
+	gdt[(GD_TSS0 >> 3) + i].sd_s = 0;
 
 	// Load the TSS selector (like other segment selectors, the
 	// bottom three bits are special; we leave them 0)
-	ltr(GD_TSS0);
+	ltr(GD_TSS0 + (i << 3));
 
 	// Load the IDT
 	lidt(&idt_pd);
+
+	// sysenter uses the same kernel stack as traps.
+	void sysenter_handler();
+	if (cpu_has_sysenter()) {
+		wrmsr(MSR_SYSENTER_CS, GD_KT);
+		wrmsr(MSR_SYSENTER_ESP, KSTACKTOP_CPU(i));
+		wrmsr(MSR_SYSENTER_EIP, (uint32_t) sysenter_handler);
+	}
 }
 
 void
 print_trapframe(struct Trapframe *tf)
 {
-	cprintf("TRAP frame at %p\n", tf);
+	cprintf("TRAP frame at %p from CPU %d\n", tf, cpunum());
 	print_regs(&tf->tf_regs);
 	cprintf("  es   0x----%04x\n", tf->tf_es);
 	cprintf("  ds   0x----%04x\n", tf->tf_ds);
@@ -144,6 +209,41 @@ trap_dispatch(struct Trapframe *tf)
 {
 	// Handle processor exceptions.
 	// LAB 3: Your code here.
+	switch (tf->tf_trapno) {
+	case T_PGFLT:
+		page_fault_handler(tf);
+		return;
+	case T_BRKPT:
+		monitor(tf);
+		return;
+	case T_SYSCALL:
+		tf->tf_regs.reg_eax = syscall(tf->tf_regs.reg_eax,
+					      tf->tf_regs.reg_edx,
+					      tf->tf_regs.reg_ecx,
+					      tf->tf_regs.reg_ebx,
+					      tf->tf_regs.reg_edi,
+					      tf->tf_regs.reg_esi);
+		return;
+	}
+
+	// Handle spurious interrupts
+	// The hardware sometimes raises these because of noise on the
+	// IRQ line or other reasons. We don't care.
+	if (tf->tf_trapno == IRQ_OFFSET + IRQ_SPURIOUS) {
+		cprintf("Spurious interrupt on irq 7\n");
+		print_trapframe(tf);
+		return;
+	}
+
+	// Handle clock interrupts. Don't forget to acknowledge the
+	// interrupt using lapic_eoi() before calling the scheduler!
+	if (tf->tf_trapno == IRQ_OFFSET + IRQ_TIMER) {
+		lapic_eoi();
+		futex_expire(read_tsc());
+		sched_tick();
+		this_cpu_write(cpu_swreason, SW_PREEMPT);
+		sched_yield();
+	}
 
 	// Unexpected trap: The user process or the kernel has a bug.
 	print_trapframe(tf);
@@ -155,6 +255,23 @@ trap_dispatch(struct Trapframe *tf)
 	}
 }
 
+// Charge curenv for its time in user mode since env_run(), and
+// count the trap.  sysno is eax, the system call number.
+static void
+account_trap(uint32_t trapno, uint32_t sysno)
+{
+	struct EnvStats *st = &curenv->env_stats;
+	uint64_t now = read_tsc();
+
+	st->es_utime += now - thiscpu->cpu_tsc;
+	rgroup_charge(curenv, now - thiscpu->cpu_tsc);
+	sched_rt_charge(curenv, now - thiscpu->cpu_tsc);
+	thiscpu->cpu_tsc = now;
+	st->es_traps[ENV_TRAPSTAT(trapno)]++;
+	if (trapno == T_SYSCALL && sysno < ENV_NSYSCALLSTAT)
+		st->es_syscalls[sysno]++;
+}
+
 void
 trap(struct Trapframe *tf)
 {
@@ -162,23 +279,53 @@ trap(struct Trapframe *tf)
 	// of GCC rely on DF being clear
 	asm volatile("cld" ::: "cc");
 
+	// Halt if some other CPU has called panic()
+	extern const char *panicstr;
+	if (panicstr)
+		asm volatile("hlt");
+
+	this_cpu_inc(cpu_ntraps);
+
+	// The CPU that sent a shootdown holds the big kernel lock and is
+	// waiting for us, so answer it without taking the lock and go
+	// straight back to whatever we interrupted.
+	if (tf->tf_trapno == T_TLBFLUSH) {
+		tlb_poll();
+		lapic_eoi();
+		env_pop_tf(tf);
+	}
+
+	// Re-acqurie the big kernel lock if we were halted in
+	// sched_yield()
+	if (xchg(&thiscpu->cpu_status, CPU_STARTED) == CPU_HALTED)
+		lock_kernel();
 	// Check that interrupts are disabled.  If this assertion
 	// fails, DO NOT be tempted to fix it by inserting a "cli" in
 	// the interrupt path.
 	assert(!(read_eflags() & FL_IF));
 
-	cprintf("Incoming TRAP frame at %p\n", tf);
-
 	if ((tf->tf_cs & 3) == 3) {
 		// Trapped from user mode.
+		// Acquire the big kernel lock before doing any
+		// serious kernel work.
+		lock_kernel();
 		assert(curenv);
 
-		// Copy trap frame (which is currently on the stack)
-		// into 'curenv->env_tf', so that running the environment
-		// will restart at the trap point.
-		curenv->env_tf = *tf;
-		// The trapframe on the stack should be ignored from here on.
-		tf = &curenv->env_tf;
+		// Garbage collect if current enviroment is a zombie
+		if (curenv->env_status == ENV_DYING) {
+			env_reclaim(curenv);
+			sched_yield();
+		}
+
+		account_trap(tf->tf_trapno, tf->tf_regs.reg_eax);
+
+		// The trap frame was built in 'curenv->env_tf' (see
+		// _alltraps), so running the environment will restart
+		// at the trap point.
+		assert(tf == &curenv->env_tf);
+
+		if (env_cold(curenv)->env_ring)
+			uring_poll(curenv);
 	}
 
 	// Record that tf is the last real trapframe so
@@ -188,9 +335,65 @@ trap(struct Trapframe *tf)
 	// Dispatch based on what type of trap occurred
 	trap_dispatch(tf);
 
-	// Return to the current environment, which should be running.
-	assert(curenv && curenv->env_status == ENV_RUNNING);
-	env_run(curenv);
+	// If we made it to this point, then no other environment was
+	// scheduled, so we should return to the current environment
+	// if doing so makes sense.  An env that trapped from user mode
+	// goes straight back, without the work of a switch.
+	if (curenv && curenv->env_status == ENV_RUNNING) {
+		if (tf == &curenv->env_tf)
+			env_resume();
+		env_run(curenv);
+	}
+	sched_yield();
+}
+
+//
+// System call through sysenter_handler (see trapentry.S).
+// Unlike trap(), this does not build a full Trapframe: the calling
+// convention preserves only ebx, edi, esi and ebp, so those and the
+// return eip and esp are all that go into curenv->env_tf.  That is
+// enough for env_pop_tf to resume the env if the call blocks or
+// yields; otherwise the result goes straight back through sysexit.
+//
+int32_t
+sysenter_trap(uint32_t num, uint32_t a1, uint32_t a2, uint32_t a3,
+	      uint32_t a4, uint32_t eip, uint32_t esp)
+{
+	struct Trapframe *tf;
+	int32_t ret;
+
+	lock_kernel();
+	if (curenv->env_status == ENV_DYING) {
+		env_reclaim(curenv);
+		sched_yield();
+	}
+	account_trap(T_SYSCALL, num);
+	if (env_cold(curenv)->env_ring)
+		uring_poll(curenv);
+
+	tf = &curenv->env_tf;
+	tf->tf_regs.reg_ebx = a3;
+	tf->tf_regs.reg_edi = a4;
+	tf->tf_regs.reg_esi = eip;
+	tf->tf_regs.reg_ebp = esp;
+	tf->tf_eip = eip;
+	tf->tf_esp = esp;
+	last_tf = tf;
+
+	ret = syscall(num, a1, a2, a3, a4, 0);
+
+	// Take the slow way back if curenv should not run now or the
+	// kernel changed where it resumes.
+	if (curenv->env_status != ENV_RUNNING
+	    || tf->tf_eip != eip || tf->tf_esp != esp) {
+		tf->tf_regs.reg_eax = ret;
+		if (curenv->env_status == ENV_RUNNING)
+			env_run(curenv);
+		sched_yield();
+	}
+
+	env_leave_kernel();
+	return ret;
 }
 
 
@@ -198,17 +401,71 @@ void
 page_fault_handler(struct Trapframe *tf)
 {
 	uint32_t fault_va;
+	void *upcall;
 
 	// Read processor's CR2 register to find the faulting address
 	fault_va = rcr2();
 
+	if (curenv)
+		curenv->env_stats.es_pgfaults++;
+
+	// A write to a copy-on-write page (see env_snapshot) gets a
+	// private copy of the page, whether the env wrote it or the
+	// kernel did on its behalf.  A kernel-mode fault resumes the
+	// kernel code that took it.
+	if ((tf->tf_err & (FEC_PR | FEC_WR)) == (FEC_PR | FEC_WR) && curenv
+	    && page_cow(curenv, (void *) fault_va) == 0) {
+		if ((tf->tf_cs & 3) == 0)
+			env_pop_tf(tf);
+		return;
+	}
+
 	// Handle kernel-mode page faults.
 
 	// LAB 3: Your code here.
+	if ((tf->tf_cs & 3) == 0) {
+		print_trapframe(tf);
+		panic("kernel page fault at va %08x", fault_va);
+	}
 
 	// We've already handled kernel-mode exceptions, so if we get here,
 	// the page fault happened in user mode.
 
+	// Call the environment's page fault upcall, if one exists.  Set up a
+	// page fault stack frame on the thread's exception stack (below
+	// UTXSTACKTOP), then branch to the env's env_pgfault_upcall.
+	//
+	// The page fault upcall might cause another page fault, in which
+	// case we branch to the page fault upcall recursively, pushing
+	// another page fault stack frame on top of the user exception
+	// stack.  The new frame starts a word below the faulting esp,
+	// leaving the trampoline a scratch word to put the trap-time eip in
+	// when it returns (see lib/pfentry.S).
+	//
+	// If the exception stack overflows, or is not mapped writable,
+	// user_mem_assert destroys the environment.
+	if ((upcall = env_cold(curenv)->env_pgfault_upcall)) {
+		uintptr_t xtop = UTXSTACKTOP(curenv->env_tid);
+		struct UTrapframe *utf;
+
+		if (tf->tf_esp < xtop && tf->tf_esp >= xtop - PGSIZE)
+			utf = (struct UTrapframe *)
+				(tf->tf_esp - sizeof(uint32_t)) - 1;
+		else
+			utf = (struct UTrapframe *) xtop - 1;
+		user_mem_assert(curenv, utf, sizeof(*utf), PTE_W);
+
+		utf->utf_fault_va = fault_va;
+		utf->utf_err = tf->tf_err;
+		utf->utf_regs = tf->tf_regs;
+		utf->utf_eip = tf->tf_eip;
+		utf->utf_eflags = tf->tf_eflags;
+		utf->utf_esp = tf->tf_esp;
+		tf->tf_eip = (uintptr_t) upcall;
+		tf->tf_esp = (uintptr_t) utf;
+		return;
+	}
+
 	// Destroy the environment that caused the fault.
 	cprintf("[%08x] user fault va %08x ip %08x\n",
 		curenv->env_id, fault_va, tf->tf_eip);
@@ -18,6 +18,8 @@ void trap_init_percpu(void);
 void print_regs(struct PushRegs *regs);
 void print_trapframe(struct Trapframe *tf);
 void page_fault_handler(struct Trapframe *);
+int32_t sysenter_trap(uint32_t num, uint32_t a1, uint32_t a2, uint32_t a3,
+		      uint32_t a4, uint32_t eip, uint32_t esp);
 void backtrace(struct Trapframe *);
 
 #endif /* JOS_KERN_TRAP_H */
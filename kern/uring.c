@@ -0,0 +1,100 @@
+// System call rings (see inc/uring.h).
+//
+// The kernel reaches an env's ring page through its own mapping of
+// physical memory, and runs the queued calls with syscall() on behalf
+// of curenv, so only the env that owns a ring drains it.  The env can
+// change the page at any time: each entry is copied before it is
+// used, and every index is reduced modulo URING_NENTRY, so a confused
+// env can only hurt itself.
+
+#include <inc/error.h>
+#include <inc/syscall.h>
+#include <inc/uring.h>
+
+#include <kern/uring.h>
+#include <kern/env.h>
+#include <kern/pmap.h>
+#include <kern/syscall.h>
+#include <kern/rgroup.h>
+
+//
+// Give e a system call ring, in a new zeroed page mapped at va.
+//
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_INVAL if va >= UTOP or is not page-aligned, or e has a ring
+//	-E_NO_MEM on memory exhaustion
+//
+int
+uring_setup(struct Env *e, void *va)
+{
+	struct PageInfo *pp;
+
+	static_assert(sizeof(struct URing) <= PGSIZE);
+	if ((uintptr_t) va >= UTOP || PGOFF(va) || env_cold(e)->env_ring)
+		return -E_INVAL;
+	if (!(pp = rgroup_page_alloc(e, ALLOC_ZERO)))
+		return -E_NO_MEM;
+	if (page_insert(e->env_pgdir, pp, va, PTE_P | PTE_U | PTE_W) < 0) {
+		page_free(pp);
+		return -E_NO_MEM;
+	}
+	pp->pp_ref++;
+	env_cold(e)->env_ring = pp;
+	return 0;
+}
+
+//
+// Run the system calls queued on curenv's ring, e, and post their
+// results.  Takes at most one ring's worth of entries, and no more
+// than there is room for in the completion queue.
+// Returns the number of entries taken.
+//
+int
+uring_drain(struct Env *e)
+{
+	struct URing *ur = page2kva(env_cold(e)->env_ring);
+	struct URingSqe sqe;
+	struct URingCqe *cqe;
+	uint32_t head = ur->ur_sq_head, cq_tail = ur->ur_cq_tail;
+	int n;
+
+	assert(e == curenv);
+	for (n = 0; n < URING_NENTRY && head != ur->ur_sq_tail; n++) {
+		if (cq_tail - ur->ur_cq_head >= URING_NENTRY)
+			break;
+		sqe = ur->ur_sq[head % URING_NENTRY];
+		cqe = &ur->ur_cq[cq_tail % URING_NENTRY];
+		cqe->cqe_tag = sqe.sqe_tag;
+		cqe->cqe_res = syscall_batched(sqe.sqe_num, sqe.sqe_args);
+		head++;
+		cq_tail++;
+		// Publish the completion only after it is written.
+		asm volatile("" : : : "memory");
+		ur->ur_cq_tail = cq_tail;
+		ur->ur_sq_head = head;
+	}
+	return n;
+}
+
+// Drain e's ring, if it has one that asks to be polled.  Called on
+// every entry to the kernel from e.
+void
+uring_poll(struct Env *e)
+{
+	struct PageInfo *pp = env_cold(e)->env_ring;
+
+	if (pp && (((struct URing *) page2kva(pp))->ur_flags & URING_POLL))
+		uring_drain(e);
+}
+
+// Drop e's reference to its ring page.
+void
+uring_free(struct Env *e)
+{
+	struct EnvCold *c = env_cold(e);
+
+	if (c->env_ring) {
+		page_decref(c->env_ring);
+		c->env_ring = NULL;
+	}
+}
@@ -0,0 +1,18 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_URING_H
+#define JOS_KERN_URING_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+
+struct Env;
+
+int	uring_setup(struct Env *e, void *va);
+int	uring_drain(struct Env *e);
+void	uring_poll(struct Env *e);
+void	uring_free(struct Env *e);
+
+#endif	// !JOS_KERN_URING_H
@@ -0,0 +1,73 @@
+// Building vectors of system calls for sys_batch().
+//
+// Queue calls with batch_add() or one of its wrappers, then run them
+// all with one trap with batch_run().  The wrappers take the same
+// arguments as the sys_* calls they stand for.
+
+#include <inc/lib.h>
+
+void
+batch_init(struct SyscallBatch *b)
+{
+	b->sb_n = 0;
+}
+
+// Queue system call num.  Returns its index in the batch, or -E_NO_MEM
+// if the batch is full.
+int
+batch_add(struct SyscallBatch *b, uint32_t num, uint32_t a1, uint32_t a2,
+	  uint32_t a3, uint32_t a4, uint32_t a5)
+{
+	struct SyscallDesc *d;
+
+	if (b->sb_n == SYS_BATCH_MAX)
+		return -E_NO_MEM;
+	d = &b->sb_desc[b->sb_n];
+	d->sd_num = num;
+	d->sd_args[0] = a1;
+	d->sd_args[1] = a2;
+	d->sd_args[2] = a3;
+	d->sd_args[3] = a4;
+	d->sd_args[4] = a5;
+	return b->sb_n++;
+}
+
+int
+batch_page_alloc(struct SyscallBatch *b, envid_t envid, void *va, int perm)
+{
+	return batch_add(b, SYS_page_alloc, envid, (uint32_t) va, perm, 0, 0);
+}
+
+int
+batch_page_map(struct SyscallBatch *b, envid_t srcenv, void *srcva,
+	       envid_t dstenv, void *dstva, int perm)
+{
+	return batch_add(b, SYS_page_map, srcenv, (uint32_t) srcva,
+			 dstenv, (uint32_t) dstva, perm);
+}
+
+int
+batch_page_unmap(struct SyscallBatch *b, envid_t envid, void *va)
+{
+	return batch_add(b, SYS_page_unmap, envid, (uint32_t) va, 0, 0, 0);
+}
+
+int
+batch_env_set_status(struct SyscallBatch *b, envid_t envid, int status)
+{
+	return batch_add(b, SYS_env_set_status, envid, status, 0, 0, 0);
+}
+
+// Run the queued calls and empty the batch.  Returns 0 if every call
+// succeeded, or the error from the first one that failed, after which
+// nothing else ran.  Each call's result is left in its sd_ret.
+int
+batch_run(struct SyscallBatch *b)
+{
+	int n = b->sb_n, r;
+
+	b->sb_n = 0;
+	if ((r = sys_batch(b->sb_desc, n)) < 0)
+		return r;
+	return r < n ? b->sb_desc[r].sd_ret : 0;
+}
@@ -0,0 +1,118 @@
+// Channels: single-producer, single-consumer message rings in shared
+// memory (see inc/chan.h).
+//
+// A message costs no system call unless the ring was empty with the
+// consumer asleep, or full with the producer asleep.  Each side moves
+// its index, and sets its wait flag, with xchg: a full barrier, so the
+// load of the other side's flag, or index, that follows cannot pass
+// it.  Then either the sleeper sees the new index before it sleeps, or
+// the waker sees the flag and wakes it; and sys_futex_wait itself
+// refuses to sleep if the index has moved.
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define MSGHDR	sizeof(uint32_t)
+
+// Set up a channel of npages ring pages shared with peer, mapped at
+// va here and at peerva in peer, and open it in c.  The peer opens
+// its end with chan_attach.
+int
+chan_create(struct Chan *c, envid_t peer, void *va, void *peerva,
+	    uint32_t npages)
+{
+	int r;
+
+	if ((r = sys_chan_create(peer, va, peerva, npages)) < 0)
+		return r;
+	chan_attach(c, va);
+	return 0;
+}
+
+// Open the channel whose header page is mapped at va.
+void
+chan_attach(struct Chan *c, void *va)
+{
+	c->c_hdr = va;
+	c->c_ring = (uint8_t *) va + PGSIZE;
+	c->c_mask = c->c_hdr->ch_size - 1;
+}
+
+// Copy n bytes into the ring at byte offset off, wrapping at the end.
+static void
+ring_put(struct Chan *c, uint32_t off, const void *src, size_t n)
+{
+	size_t first;
+
+	off &= c->c_mask;
+	first = MIN(n, c->c_mask + 1 - off);
+	memcpy(c->c_ring + off, src, first);
+	memcpy(c->c_ring, (const uint8_t *) src + first, n - first);
+}
+
+static void
+ring_get(struct Chan *c, uint32_t off, void *dst, size_t n)
+{
+	size_t first;
+
+	off &= c->c_mask;
+	first = MIN(n, c->c_mask + 1 - off);
+	memcpy(dst, c->c_ring + off, first);
+	memcpy((uint8_t *) dst + first, c->c_ring, n - first);
+}
+
+// Send the len bytes at buf, sleeping while the ring is too full.
+// Only one env may send on a channel.
+//
+// Returns 0 on success, or -E_INVAL if the message can never fit.
+int
+chan_send(struct Chan *c, const void *buf, size_t len)
+{
+	struct ChanHdr *h = c->c_hdr;
+	uint32_t head = h->ch_head, tail, need, n = len;
+
+	need = MSGHDR + ROUNDUP(n, 4);
+	if (need > c->c_mask + 1)
+		return -E_INVAL;
+	while (head - (tail = h->ch_tail) + need > c->c_mask + 1) {
+		xchg(&h->ch_wwait, 1);
+		if (h->ch_tail == tail)
+			sys_futex_wait(&h->ch_tail, tail, 0);
+		h->ch_wwait = 0;
+	}
+
+	ring_put(c, head, &n, MSGHDR);
+	ring_put(c, head + MSGHDR, buf, n);
+	xchg(&h->ch_head, head + need);
+	if (h->ch_rwait)
+		sys_futex_wake(&h->ch_head, 1);
+	return 0;
+}
+
+// Receive the next message into buf, which holds len bytes, sleeping
+// while the ring is empty.  Only one env may receive on a channel.
+//
+// Returns the message's length, or -E_INVAL if it is longer than len,
+// in which case the message stays in the ring.
+int
+chan_recv(struct Chan *c, void *buf, size_t len)
+{
+	struct ChanHdr *h = c->c_hdr;
+	uint32_t tail = h->ch_tail, head, n;
+
+	while ((head = h->ch_head) == tail) {
+		xchg(&h->ch_rwait, 1);
+		if (h->ch_head == head)
+			sys_futex_wait(&h->ch_head, head, 0);
+		h->ch_rwait = 0;
+	}
+
+	ring_get(c, tail, &n, MSGHDR);
+	if (n > len)
+		return -E_INVAL;
+	ring_get(c, tail + MSGHDR, buf, n);
+	xchg(&h->ch_tail, tail + MSGHDR + ROUNDUP(n, 4));
+	if (h->ch_wwait)
+		sys_futex_wake(&h->ch_tail, 1);
+	return n;
+}
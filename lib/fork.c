@@ -0,0 +1,26 @@
+// fork() on top of environment templates.
+
+#include <inc/lib.h>
+
+// Create a child that is a copy-on-write copy of this env, by
+// capturing a template (see sys_env_snapshot) and starting one
+// clone of it.  The kernel does the copy-on-write, so no user page
+// fault handler is needed.
+//
+// Returns the child's envid to the parent, 0 to the child, and < 0
+// on error.
+envid_t
+fork(void)
+{
+	envid_t tmpl, child;
+
+	if ((tmpl = sys_env_snapshot()) < 0)
+		return tmpl;
+	if (tmpl == 0) {
+		thisenv = &envs[ENVX(sys_getenvid())];
+		return 0;
+	}
+	child = sys_env_clone(tmpl);
+	sys_env_destroy(tmpl);
+	return child;
+}
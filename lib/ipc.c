@@ -0,0 +1,73 @@
+// User-level IPC library routines
+
+#include <inc/lib.h>
+
+// Receive a value via IPC and return it.
+// If 'pg' is nonnull, then any page sent by the sender will be mapped at
+//	that address.
+// If 'from_env_store' is nonnull, then store the IPC sender's envid in
+//	*from_env_store.
+// If 'perm_store' is nonnull, then store the IPC sender's page permission
+//	in *perm_store (this is nonzero iff a page was successfully
+//	transferred to 'pg').
+// If the system call fails, then store 0 in *fromenv and *perm (if
+//	they're nonnull) and return the error.
+// Otherwise, return the value sent by the sender.
+int32_t
+ipc_recv(envid_t *from_env_store, void *pg, int *perm_store)
+{
+	uint32_t value;
+	envid_t from;
+	int perm;
+
+	if ((from = sys_ipc_recv(pg ? pg : (void *) UTOP, &value, &perm)) < 0) {
+		value = from;
+		from = perm = 0;
+	}
+	if (from_env_store)
+		*from_env_store = from;
+	if (perm_store)
+		*perm_store = perm;
+	return value;
+}
+
+// Send 'val' (and 'pg' with 'perm', if 'pg' is nonnull) to 'toenv'.
+// This function keeps trying until it succeeds, handing the CPU to
+// 'toenv' between tries so that it can get to its receive.
+// It should panic() on any error other than -E_IPC_NOT_RECV.
+void
+ipc_send(envid_t to_env, uint32_t val, void *pg, int perm)
+{
+	int r;
+
+	while ((r = sys_ipc_try_send(to_env, val, pg ? pg : (void *) UTOP,
+				     perm)) == -E_IPC_NOT_RECV)
+		sys_yield_to(to_env);
+	if (r < 0)
+		panic("ipc_send: %e", r);
+}
+
+// Send 'val' to 'to_env' as ipc_send does, then wait for the reply as
+// ipc_recv does, in one system call (see sys_ipc_call).  'pg' is sent
+// only if 'perm' is nonzero; a page in the reply is mapped at 'pg'.
+// A server answers a call and waits for the next one by calling back.
+int32_t
+ipc_call(envid_t to_env, uint32_t val, void *pg, int perm,
+	 envid_t *from_env_store, int *perm_store)
+{
+	uint32_t value;
+	envid_t from;
+	int rperm;
+
+	pg = pg ? pg : (void *) UTOP;
+	while ((from = sys_ipc_call(to_env, val, pg, perm, &value,
+				    &rperm)) == -E_IPC_NOT_RECV)
+		sys_yield_to(to_env);
+	if (from < 0)
+		panic("ipc_call: %e", from);
+	if (from_env_store)
+		*from_env_store = from;
+	if (perm_store)
+		*perm_store = rperm;
+	return value;
+}
@@ -2,6 +2,7 @@
 // entry.S already took care of defining envs, pages, uvpd, and uvpt.
 
 #include <inc/lib.h>
+#include <inc/x86.h>
 
 extern void umain(int argc, char **argv);
 
@@ -13,7 +14,8 @@ libmain(int argc, char **argv)
 {
 	// set thisenv to point at our Env structure in envs[].
 	// LAB 3: Your code here.
-	thisenv = 0;
+	syscall_sysenter = cpu_has_sysenter();
+	thisenv = &envs[ENVX(getenvid())];
 
 	// save the name of the program so that panic() can use it
 	if (argc > 0)
@@ -0,0 +1,44 @@
+// User-level page fault handler support.
+// Rather than register the C page fault handler directly with the
+// kernel as the page fault handler, we register the assembly language
+// wrapper in pfentry.S, which in turn calls the registered C
+// function.
+
+#include <inc/lib.h>
+
+
+// Assembly language pgfault entrypoint defined in lib/pfentry.S.
+extern void _pgfault_upcall(void);
+
+// Pointer to currently installed C-language pgfault handler.
+void (*_pgfault_handler)(struct UTrapframe *utf);
+
+//
+// Set the page fault handler function.
+// If there isn't one yet, _pgfault_handler will be 0.
+// The first time we register a handler, we need to
+// allocate an exception stack (one page of memory with its top
+// at UTXSTACKTOP for the calling thread), and tell the kernel to
+// call the assembly-language _pgfault_upcall routine when a page
+// fault occurs.  Threads created afterwards get an exception stack
+// and the upcall from the kernel; threads that already exist keep
+// dying on faults.
+//
+void
+set_pgfault_handler(void (*handler)(struct UTrapframe *utf))
+{
+	envid_t id = sys_getenvid();
+	uintptr_t xtop = UTXSTACKTOP(envs[ENVX(id)].env_tid);
+	int r;
+
+	if (_pgfault_handler == 0) {
+		if ((r = sys_page_alloc(id, (void *) (xtop - PGSIZE),
+					PTE_P | PTE_U | PTE_W)) < 0)
+			panic("set_pgfault_handler: %e", r);
+		if ((r = sys_env_set_pgfault_upcall(id, _pgfault_upcall)) < 0)
+			panic("set_pgfault_handler: %e", r);
+	}
+
+	// Save handler pointer for assembly to call.
+	_pgfault_handler = handler;
+}
@@ -26,6 +26,12 @@ static const char * const error_string[MAXERROR] =
 	[E_NO_MEM]	= "out of memory",
 	[E_NO_FREE_ENV]	= "out of environments",
 	[E_FAULT]	= "segmentation fault",
+	[E_OVERLOAD]	= "CPU overloaded",
+	[E_IPC_NOT_RECV]	= "env is not recving",
+	[E_AGAIN]	= "try again",
+	[E_TIMEOUT]	= "timed out",
+	[E_NOT_FOUND]	= "not found",
+	[E_EXISTS]	= "already exists",
 };
 
 /*
@@ -0,0 +1,147 @@
+// Mutexes, condition variables and semaphores on top of futexes
+// (see sys_futex_wait).
+//
+// None of these makes a system call unless it has to sleep or to wake
+// a sleeper.  Futexes are keyed by physical address, so any of them
+// works between envs that share the page it is in, as well as between
+// threads.  Timeouts are in microseconds; 0 means wait for ever.
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+// A mutex is 0 when free, 1 when held, and 2 when held and someone may
+// be asleep waiting for it, so that an unlock only calls the kernel
+// when there is someone to wake.  After Drepper, "Futexes Are Tricky".
+
+void
+mutex_init(struct Mutex *m)
+{
+	m->m_state = 0;
+}
+
+bool
+mutex_trylock(struct Mutex *m)
+{
+	return cmpxchg(&m->m_state, 0, 1) == 0;
+}
+
+void
+mutex_lock(struct Mutex *m)
+{
+	uint32_t c;
+
+	if ((c = cmpxchg(&m->m_state, 0, 1)) == 0)
+		return;
+	// Mark the mutex contended, and sleep until it is free.
+	if (c != 2)
+		c = xchg(&m->m_state, 2);
+	while (c != 0) {
+		sys_futex_wait(&m->m_state, 2, 0);
+		c = xchg(&m->m_state, 2);
+	}
+}
+
+void
+mutex_unlock(struct Mutex *m)
+{
+	if (xchg(&m->m_state, 0) == 2)
+		sys_futex_wake(&m->m_state, 1);
+}
+
+// A condition variable is a sequence number.  A waiter sleeps unless
+// a signal has bumped it since the waiter read it under the mutex.
+
+void
+cond_init(struct Cond *c)
+{
+	c->c_seq = 0;
+}
+
+// Release m, wait for a signal, and take m again.  As with any
+// condition variable, the caller must recheck its condition.
+//
+// Returns 0, or -E_TIMEOUT if no signal came within timeout.
+int
+cond_wait(struct Cond *c, struct Mutex *m, uint32_t timeout)
+{
+	uint32_t seq = c->c_seq;
+	int r;
+
+	mutex_unlock(m);
+	r = sys_futex_wait(&c->c_seq, seq, timeout);
+	// Others may be waiting for m too, so take it as contended.
+	while (xchg(&m->m_state, 2) != 0)
+		sys_futex_wait(&m->m_state, 2, 0);
+	return r == -E_TIMEOUT ? r : 0;
+}
+
+void
+cond_signal(struct Cond *c)
+{
+	atomic_add(&c->c_seq, 1);
+	sys_futex_wake(&c->c_seq, 1);
+}
+
+void
+cond_broadcast(struct Cond *c)
+{
+	atomic_add(&c->c_seq, 1);
+	sys_futex_wake(&c->c_seq, ~0U);
+}
+
+// A semaphore's waiters sleep on its count while it is 0.  s_waiters
+// lets sem_post skip the wake when nobody can be asleep.
+
+void
+sem_init(struct Sem *s, uint32_t count)
+{
+	s->s_count = count;
+	s->s_waiters = 0;
+}
+
+bool
+sem_trywait(struct Sem *s)
+{
+	uint32_t v;
+
+	while ((v = s->s_count) > 0)
+		if (cmpxchg(&s->s_count, v, v - 1) == v)
+			return 1;
+	return 0;
+}
+
+// Returns 0, or -E_TIMEOUT if the count stayed 0 for timeout.
+int
+sem_wait(struct Sem *s, uint32_t timeout)
+{
+	uint64_t now, deadline = timeout ? gettime() + timeout : 0;
+	uint32_t left = 0;
+	int r = 0;
+
+	if (sem_trywait(s))
+		return 0;
+	atomic_add(&s->s_waiters, 1);
+	while (!sem_trywait(s)) {
+		if (deadline) {
+			if ((now = gettime()) >= deadline) {
+				r = -E_TIMEOUT;
+				break;
+			}
+			left = deadline - now;
+		}
+		if (sys_futex_wait(&s->s_count, 0, left) == -E_TIMEOUT) {
+			r = -E_TIMEOUT;
+			break;
+		}
+	}
+	atomic_add(&s->s_waiters, -1);
+	return r;
+}
+
+void
+sem_post(struct Sem *s)
+{
+	atomic_add(&s->s_count, 1);
+	if (s->s_waiters)
+		sys_futex_wake(&s->s_count, 1);
+}
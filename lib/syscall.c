@@ -3,11 +3,37 @@
 #include <inc/syscall.h>
 #include <inc/lib.h>
 
+// Whether to enter the kernel with sysenter rather than int, set by
+// libmain if the CPU supports it.
+bool syscall_sysenter;
+
+// The third and fourth parameters are passed through a3 and a4, which
+// are updated to the BX and DI the call returns with.  Only the IPC
+// receives change these (see sys_ipc_recv below).
 static inline int32_t
-syscall(int num, int check, uint32_t a1, uint32_t a2, uint32_t a3, uint32_t a4, uint32_t a5)
+syscall_regs(int num, int check, uint32_t a1, uint32_t a2, uint32_t *a3, uint32_t *a4, uint32_t a5)
 {
 	int32_t ret;
 
+	// Fast system call (see sysenter_handler in kern/trapentry.S):
+	// number in AX, up to four parameters in DX, CX, BX, DI, and
+	// the return address and stack in SI and BP.  The kernel
+	// preserves BP, and BX and DI except in an IPC receive.  A fifth
+	// parameter has no register left, so calls that pass one take
+	// the slow path below.
+	if (syscall_sysenter && a5 == 0) {
+		asm volatile("pushl %%ebp\n"
+			     "\tmovl %%esp, %%ebp\n"
+			     "\tleal 1f, %%esi\n"
+			     "\tsysenter\n"
+			     "1:\tpopl %%ebp\n"
+			     : "=a" (ret), "+d" (a1), "+c" (a2),
+			       "+b" (*a3), "+D" (*a4)
+			     : "a" (num)
+			     : "esi", "cc", "memory");
+		goto done;
+	}
+
 	// Generic system call: pass system call number in AX,
 	// up to five parameters in DX, CX, BX, DI, SI.
 	// Interrupt kernel with T_SYSCALL.
@@ -20,23 +46,28 @@ syscall(int num, int check, uint32_t a1, uint32_t a2, uint32_t a3, uint32_t a4,
 	// potentially change the condition codes and arbitrary
 	// memory locations.
 
-	asm volatile("int %1\n"
-		     : "=a" (ret)
+	asm volatile("int %3\n"
+		     : "=a" (ret), "+b" (*a3), "+D" (*a4)
 		     : "i" (T_SYSCALL),
 		       "a" (num),
 		       "d" (a1),
 		       "c" (a2),
-		       "b" (a3),
-		       "D" (a4),
 		       "S" (a5)
 		     : "cc", "memory");
 
+done:
 	if(check && ret > 0)
 		panic("syscall %d returned %d (> 0)", num, ret);
 
 	return ret;
 }
 
+static inline int32_t
+syscall(int num, int check, uint32_t a1, uint32_t a2, uint32_t a3, uint32_t a4, uint32_t a5)
+{
+	return syscall_regs(num, check, a1, a2, &a3, &a4, a5);
+}
+
 void
 sys_cputs(const char *s, size_t len)
 {
@@ -61,3 +92,198 @@ sys_getenvid(void)
 	 return syscall(SYS_getenvid, 0, 0, 0, 0, 0, 0);
 }
 
+void
+sys_yield(void)
+{
+	syscall(SYS_yield, 0, 0, 0, 0, 0, 0);
+}
+
+int
+sys_page_alloc(envid_t envid, void *va, int perm)
+{
+	return syscall(SYS_page_alloc, 1, envid, (uint32_t) va, perm, 0, 0);
+}
+
+int
+sys_page_map(envid_t srcenv, void *srcva, envid_t dstenv, void *dstva, int perm)
+{
+	return syscall(SYS_page_map, 1, srcenv, (uint32_t) srcva, dstenv, (uint32_t) dstva, perm);
+}
+
+int
+sys_page_unmap(envid_t envid, void *va)
+{
+	return syscall(SYS_page_unmap, 1, envid, (uint32_t) va, 0, 0, 0);
+}
+
+int
+sys_env_set_status(envid_t envid, int status)
+{
+	return syscall(SYS_env_set_status, 1, envid, status, 0, 0, 0);
+}
+
+int
+sys_env_set_pgfault_upcall(envid_t envid, void *upcall)
+{
+	return syscall(SYS_env_set_pgfault_upcall, 1, envid, (uint32_t) upcall, 0, 0, 0);
+}
+
+envid_t
+sys_env_snapshot(void)
+{
+	return syscall(SYS_env_snapshot, 1, 0, 0, 0, 0, 0);
+}
+
+envid_t
+sys_env_clone(envid_t tmpl)
+{
+	return syscall(SYS_env_clone, 1, tmpl, 0, 0, 0, 0);
+}
+
+envid_t
+sys_thread_create(void (*fn)(void *), void *arg, void (*ret)(void))
+{
+	return syscall(SYS_thread_create, 1, (uint32_t) fn, (uint32_t) arg,
+		       (uint32_t) ret, 0, 0);
+}
+
+int
+sys_rgroup_create(uint32_t weight, uint32_t page_limit, uint32_t rt_limit)
+{
+	return syscall(SYS_rgroup_create, 0, weight, page_limit, rt_limit,
+		       0, 0);
+}
+
+int
+sys_env_set_rgroup(envid_t envid, uint32_t gid)
+{
+	return syscall(SYS_env_set_rgroup, 1, envid, gid, 0, 0, 0);
+}
+
+int
+sys_rgroup_destroy(uint32_t gid)
+{
+	return syscall(SYS_rgroup_destroy, 1, gid, 0, 0, 0, 0);
+}
+
+int
+sys_env_spawn(const char *name, uint32_t n, envid_t *ids)
+{
+	return syscall(SYS_env_spawn, 0, (uint32_t) name, strlen(name), n,
+		       (uint32_t) ids, 0);
+}
+
+void
+sys_yield_to(envid_t envid)
+{
+	syscall(SYS_yield_to, 0, envid, 0, 0, 0, 0);
+}
+
+int
+sys_env_set_rt(envid_t envid, uint32_t runtime, uint32_t period,
+	       uint32_t deadline)
+{
+	return syscall(SYS_env_set_rt, 1, envid, runtime, period, deadline, 0);
+}
+
+int
+sys_rt_wait(void)
+{
+	return syscall(SYS_rt_wait, 0, 0, 0, 0, 0, 0);
+}
+
+int
+sys_ring_setup(void *va)
+{
+	return syscall(SYS_ring_setup, 1, (uint32_t) va, 0, 0, 0, 0);
+}
+
+int
+sys_ring_enter(void)
+{
+	return syscall(SYS_ring_enter, 0, 0, 0, 0, 0, 0);
+}
+
+int
+sys_batch(struct SyscallDesc *v, int n)
+{
+	return syscall(SYS_batch, 0, (uint32_t) v, n, 0, 0, 0);
+}
+
+int
+sys_ipc_try_send(envid_t envid, uint32_t value, void *srcva, int perm)
+{
+	return syscall(SYS_ipc_try_send, 0, envid, value, (uint32_t) srcva, perm, 0);
+}
+
+// The message comes back in registers: the sender's envid as the
+// result, and the value and page permissions in BX and DI.
+envid_t
+sys_ipc_recv(void *dstva, uint32_t *value, int *perm)
+{
+	uint32_t b = 0, d = 0;
+	envid_t r;
+
+	r = syscall_regs(SYS_ipc_recv, 0, (uint32_t) dstva, 0, &b, &d, 0);
+	*value = b;
+	*perm = d;
+	return r;
+}
+
+envid_t
+sys_ipc_call(envid_t envid, uint32_t value, void *pg, int perm,
+	     uint32_t *value_store, int *perm_store)
+{
+	uint32_t b = (uint32_t) pg, d = perm;
+	envid_t r;
+
+	r = syscall_regs(SYS_ipc_call, 0, envid, value, &b, &d, 0);
+	*value_store = b;
+	*perm_store = d;
+	return r;
+}
+
+int
+sys_futex_wait(volatile uint32_t *addr, uint32_t val, uint32_t timeout)
+{
+	return syscall(SYS_futex_wait, 0, (uint32_t) addr, val, timeout, 0, 0);
+}
+
+int
+sys_futex_wake(volatile uint32_t *addr, uint32_t n)
+{
+	return syscall(SYS_futex_wake, 0, (uint32_t) addr, n, 0, 0, 0);
+}
+
+int
+sys_chan_create(envid_t peer, void *va, void *peerva, uint32_t npages)
+{
+	return syscall(SYS_chan_create, 1, peer, (uint32_t) va,
+		       (uint32_t) peerva, npages, 0);
+}
+
+int
+sys_shm_create(const char *name, uint32_t npages, void *va, int perm)
+{
+	return syscall(SYS_shm_create, 0, (uint32_t) name, strlen(name),
+		       npages, (uint32_t) va, perm);
+}
+
+int
+sys_shm_lookup(const char *name)
+{
+	return syscall(SYS_shm_lookup, 0, (uint32_t) name, strlen(name),
+		       0, 0, 0);
+}
+
+int
+sys_shm_attach(int handle, void *va, int perm)
+{
+	return syscall(SYS_shm_attach, 0, handle, (uint32_t) va, perm, 0, 0);
+}
+
+int
+sys_shm_detach(int handle, void *va)
+{
+	return syscall(SYS_shm_detach, 0, handle, (uint32_t) va, 0, 0, 0);
+}
@@ -0,0 +1,22 @@
+// Threads sharing the caller's address space.
+// Each thread is an env of its own, so 'thisenv' still names the env
+// that started the program; threads use getenvid() instead.
+
+#include <inc/lib.h>
+
+// Start fn(arg) in a new thread.  Returning from fn ends the thread.
+// Returns the new thread's envid, or < 0 on error.
+envid_t
+thread_create(void (*fn)(void *), void *arg)
+{
+	return sys_thread_create(fn, arg, thread_exit);
+}
+
+// End the calling thread.  The address space lives on until its last
+// thread exits.
+void
+thread_exit(void)
+{
+	sys_env_destroy(0);
+	panic("thread_exit: still running");
+}
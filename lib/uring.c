@@ -0,0 +1,69 @@
+// System call rings (see inc/uring.h).
+// The ring belongs to the env that called ring_init; other threads of
+// the address space must not queue on it.
+
+#include <inc/lib.h>
+
+static struct URing *ring;
+
+// Set up a system call ring at va, a free page-aligned address.
+// flags is 0 or URING_POLL.  Returns 0 or < 0 on error.
+int
+ring_init(void *va, uint32_t flags)
+{
+	int r;
+
+	if ((r = sys_ring_setup(va)) < 0)
+		return r;
+	ring = va;
+	ring->ur_flags = flags;
+	return 0;
+}
+
+// Queue system call num with arguments a1..a5.  Its completion will
+// carry tag.  Returns 0, or -E_NO_MEM if the submission queue is full.
+int
+ring_queue(uint32_t tag, uint32_t num, uint32_t a1, uint32_t a2,
+	   uint32_t a3, uint32_t a4, uint32_t a5)
+{
+	uint32_t tail = ring->ur_sq_tail;
+	struct URingSqe *sqe;
+
+	if (tail - ring->ur_sq_head >= URING_NENTRY)
+		return -E_NO_MEM;
+	sqe = &ring->ur_sq[tail % URING_NENTRY];
+	sqe->sqe_num = num;
+	sqe->sqe_args[0] = a1;
+	sqe->sqe_args[1] = a2;
+	sqe->sqe_args[2] = a3;
+	sqe->sqe_args[3] = a4;
+	sqe->sqe_args[4] = a5;
+	sqe->sqe_tag = tag;
+	// The kernel may take the entry as soon as the tail moves.
+	asm volatile("" : : : "memory");
+	ring->ur_sq_tail = tail + 1;
+	return 0;
+}
+
+// Have the kernel run everything queued.  Returns the number of
+// entries it took.
+int
+ring_submit(void)
+{
+	return sys_ring_enter();
+}
+
+// Take the oldest completion into *cqe.  Returns 1, or 0 if there is
+// none yet.
+int
+ring_reap(struct URingCqe *cqe)
+{
+	uint32_t head = ring->ur_cq_head;
+
+	if (head == ring->ur_cq_tail)
+		return 0;
+	*cqe = ring->ur_cq[head % URING_NENTRY];
+	asm volatile("" : : : "memory");
+	ring->ur_cq_head = head + 1;
+	return 1;
+}
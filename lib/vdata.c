@@ -0,0 +1,38 @@
+// Reading the kernel's data page at UVDATA (see inc/vdata.h), which
+// answers some questions without a system call.
+
+#include <inc/lib.h>
+#include <inc/vdata.h>
+#include <inc/x86.h>
+
+static const volatile struct VData *const vdata =
+	(const volatile struct VData *) UVDATA;
+
+// Return the calling thread's envid.  The thread is found by its stack
+// (see UTSTACKSLOT), which also holds its exception stack; code
+// running on any other stack, such as thread 0's exception stack,
+// gets the answer from sys_getenvid() instead.
+envid_t
+getenvid(void)
+{
+	uintptr_t esp = read_esp();
+	envid_t id;
+
+	// A slot with no thread in it, such as one whose stack a clone
+	// inherited from its template, has envid 0.
+	if (esp < USTACKTOP && esp >= USTACKTOP - NTHREADS * UTSTACKSLOT
+	    && (id = vdata->vd_threads[(USTACKTOP - 1 - esp) / UTSTACKSLOT]
+		     .vt_envid))
+		return id;
+	return sys_getenvid();
+}
+
+// Return the time since boot in microseconds.
+uint64_t
+gettime(void)
+{
+	uint64_t cycles = read_tsc() - vdata->vd_tsc_boot;
+	uint32_t mult = vdata->vd_us_mult;
+
+	return (cycles >> 32) * mult + (((cycles & 0xffffffff) * mult) >> 32);
+}
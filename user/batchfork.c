@@ -0,0 +1,84 @@
+// Time fork-style setup of a child made by sys_exofork: give it a
+// stack page, share the program image with it read-only and mark it
+// runnable, once with a trap per call and once with sys_batch().
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define ROUNDS	32
+
+extern uint8_t end[];
+
+static envid_t
+child(void)
+{
+	envid_t id;
+
+	// The child resumes here on a fresh stack page and exits at once.
+	if ((id = sys_exofork()) == 0)
+		sys_env_destroy(0);
+	if (id < 0)
+		panic("sys_exofork: %e", id);
+	return id;
+}
+
+static void
+setup_calls(envid_t id)
+{
+	uint8_t *va;
+	int r;
+
+	if ((r = sys_page_alloc(id, (void *) (USTACKTOP - PGSIZE),
+				PTE_P | PTE_U | PTE_W)) < 0)
+		panic("sys_page_alloc: %e", r);
+	for (va = (uint8_t *) UTEXT; va < end; va += PGSIZE)
+		if ((r = sys_page_map(0, va, id, va, PTE_P | PTE_U)) < 0)
+			panic("sys_page_map: %e", r);
+	if ((r = sys_env_set_status(id, ENV_RUNNABLE)) < 0)
+		panic("sys_env_set_status: %e", r);
+}
+
+static void
+setup_batch(envid_t id)
+{
+	struct SyscallBatch b;
+	uint8_t *va;
+	int r;
+
+	batch_init(&b);
+	batch_page_alloc(&b, id, (void *) (USTACKTOP - PGSIZE),
+			 PTE_P | PTE_U | PTE_W);
+	for (va = (uint8_t *) UTEXT; va < end; va += PGSIZE)
+		if (batch_page_map(&b, 0, va, id, va, PTE_P | PTE_U) < 0)
+			panic("program too big for one batch");
+	if (batch_env_set_status(&b, id, ENV_RUNNABLE) < 0)
+		panic("program too big for one batch");
+	if ((r = batch_run(&b)) < 0)
+		panic("batch_run: %e", r);
+}
+
+void
+umain(int argc, char **argv)
+{
+	uint64_t start, total;
+	envid_t id;
+	int i, pass;
+
+	cprintf("%d pages to share\n",
+		(ROUNDUP((uint32_t) end, PGSIZE) - UTEXT) / PGSIZE);
+	for (pass = 0; pass < 2; pass++) {
+		total = 0;
+		for (i = 0; i < ROUNDS; i++) {
+			id = child();
+			start = read_tsc();
+			if (pass)
+				setup_batch(id);
+			else
+				setup_calls(id);
+			total += read_tsc() - start;
+		}
+		cprintf("%s: %u cycles per child\n",
+			pass ? "sys_batch" : "one trap per call",
+			(uint32_t) total / ROUNDS);
+	}
+}
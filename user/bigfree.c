@@ -0,0 +1,22 @@
+// Build up a 64MB address space and exit, to time env teardown.
+// Run the 'reap' monitor command afterwards: env_destroy() only takes
+// the env out of service, and the pages are freed in the background.
+
+#include <inc/lib.h>
+
+#define BIGBASE		0x10000000
+#define BIGSIZE		(64 << 20)
+
+void
+umain(int argc, char **argv)
+{
+	char *va;
+	int r;
+
+	for (va = (char *) BIGBASE; va < (char *) BIGBASE + BIGSIZE; va += PGSIZE) {
+		if ((r = sys_page_alloc(0, va, PTE_P | PTE_U | PTE_W)) < 0)
+			panic("sys_page_alloc at %08x: %e", va, r);
+		*va = 1;
+	}
+	cprintf("[%08x] mapped %d MB, exiting\n", thisenv->env_id, BIGSIZE >> 20);
+}
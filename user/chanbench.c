@@ -0,0 +1,70 @@
+// Stream messages of several sizes from this env to a child over a
+// channel, and report the throughput for each size.
+
+#include <inc/lib.h>
+
+#define CHANVA	((void *) 0xa00000)
+#define NPAGES	16
+#define TOTAL	(4 << 20)	// Bytes sent at each size
+
+static const uint32_t sizes[] = { 16, 64, 256, 1024, 4096 };
+#define NSIZES	(sizeof(sizes) / sizeof(sizes[0]))
+
+static uint32_t msg[4096 / 4];
+
+static void
+consumer(envid_t parent)
+{
+	struct Chan c;
+	uint32_t i, j, n;
+	int r;
+
+	// Wait for the parent to set the channel up.
+	ipc_recv(NULL, NULL, NULL);
+	chan_attach(&c, CHANVA);
+	for (i = 0; i < NSIZES; i++) {
+		for (j = 0; j < TOTAL / sizes[i]; j++) {
+			if ((r = chan_recv(&c, msg, sizeof(msg))) < 0)
+				panic("chan_recv: %e", r);
+			n = r;
+			if (n != sizes[i] || msg[0] != j)
+				panic("message %d: %d bytes, seq %d",
+				      j, n, msg[0]);
+		}
+		ipc_send(parent, sizes[i], NULL, 0);
+	}
+}
+
+void
+umain(int argc, char **argv)
+{
+	struct Chan c;
+	envid_t child;
+	uint64_t t0, us;
+	uint32_t i, j;
+	int r;
+
+	if ((child = fork()) < 0)
+		panic("fork: %e", child);
+	if (child == 0) {
+		consumer(thisenv->env_parent_id);
+		return;
+	}
+
+	if ((r = chan_create(&c, child, CHANVA, CHANVA, NPAGES)) < 0)
+		panic("chan_create: %e", r);
+	ipc_send(child, 0, NULL, 0);
+
+	for (i = 0; i < NSIZES; i++) {
+		t0 = gettime();
+		for (j = 0; j < TOTAL / sizes[i]; j++) {
+			msg[0] = j;
+			chan_send(&c, msg, sizes[i]);
+		}
+		// Wait for the child to take the last message.
+		ipc_recv(NULL, NULL, NULL);
+		us = gettime() - t0;
+		cprintf("%4u-byte messages: %u MB/s\n", sizes[i],
+			(uint32_t) (us ? TOTAL / us : 0));
+	}
+}
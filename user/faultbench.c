@@ -0,0 +1,67 @@
+// Time page fault upcalls: first a fault the handler fixes up without
+// a system call, by pointing the faulting load somewhere valid, and
+// then faults the handler fixes by allocating the page (lazy
+// allocation), which adds a sys_page_alloc.
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define ROUNDS	10000
+#define NPAGES	256
+
+#define BADVA	((uint32_t *) 0xd0000000)	// Never mapped
+#define LAZYVA	((char *) 0xa00000)
+
+uint32_t target = 42;
+
+static void
+redirect(struct UTrapframe *utf)
+{
+	if (utf->utf_fault_va != (uint32_t) BADVA)
+		panic("fault at %08x, eip %08x", utf->utf_fault_va,
+		      utf->utf_eip);
+	utf->utf_regs.reg_eax = (uint32_t) &target;
+}
+
+static void
+lazy(struct UTrapframe *utf)
+{
+	void *va = ROUNDDOWN((void *) utf->utf_fault_va, PGSIZE);
+	int r;
+
+	if (va < (void *) LAZYVA || va >= (void *) (LAZYVA + NPAGES * PGSIZE))
+		panic("fault at %08x, eip %08x", utf->utf_fault_va,
+		      utf->utf_eip);
+	if ((r = sys_page_alloc(0, va, PTE_P | PTE_U | PTE_W)) < 0)
+		panic("sys_page_alloc: %e", r);
+}
+
+void
+umain(int argc, char **argv)
+{
+	uint64_t start;
+	uint32_t v;
+	int i;
+
+	set_pgfault_handler(redirect);
+	start = read_tsc();
+	for (i = 0; i < ROUNDS; i++) {
+		// The handler fixes eax, and the load runs again.
+		asm volatile("movl (%%eax), %0"
+			     : "=r" (v) : "a" (BADVA) : "memory");
+		if (v != target)
+			panic("load gave %d", v);
+	}
+	cprintf("fault round trip: %u cycles\n",
+		(uint32_t) (read_tsc() - start) / ROUNDS);
+
+	set_pgfault_handler(lazy);
+	start = read_tsc();
+	for (i = 0; i < NPAGES; i++)
+		LAZYVA[i * PGSIZE] = i;
+	cprintf("lazy allocation: %u cycles per page\n",
+		(uint32_t) (read_tsc() - start) / NPAGES);
+	for (i = 0; i < NPAGES; i++)
+		if (LAZYVA[i * PGSIZE] != (char) i)
+			panic("page %d lost its write", i);
+}
@@ -0,0 +1,81 @@
+// Have several threads contend for one lock, first a spin lock that
+// yields when it finds the lock held and then a futex mutex, and
+// time the acquisitions.  Also check that a semaphore wait times out.
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define NTHR	4
+#define ROUNDS	2000
+#define WORK	100	// Loop iterations while holding the lock
+
+volatile uint32_t spinlock;
+struct Mutex mutex;
+struct Sem done;
+volatile uint32_t counter;
+int use_mutex;
+
+static void
+lock(void)
+{
+	if (use_mutex)
+		mutex_lock(&mutex);
+	else
+		while (xchg(&spinlock, 1) != 0)
+			sys_yield();
+}
+
+static void
+unlock(void)
+{
+	if (use_mutex)
+		mutex_unlock(&mutex);
+	else
+		xchg(&spinlock, 0);
+}
+
+static void
+worker(void *arg)
+{
+	int i, j;
+
+	for (i = 0; i < ROUNDS; i++) {
+		lock();
+		for (j = 0; j < WORK; j++)
+			counter++;
+		unlock();
+	}
+	sem_post(&done);
+}
+
+void
+umain(int argc, char **argv)
+{
+	uint64_t start, t0;
+	envid_t r;
+	int i;
+
+	sem_init(&done, 0);
+	t0 = gettime();
+	if (sem_wait(&done, 20000) != -E_TIMEOUT)
+		panic("sem_wait did not time out");
+	cprintf("sem_wait: 20000 us timeout took %u us\n",
+		(uint32_t) (gettime() - t0));
+
+	mutex_init(&mutex);
+	for (use_mutex = 0; use_mutex <= 1; use_mutex++) {
+		counter = 0;
+		start = read_tsc();
+		for (i = 0; i < NTHR; i++)
+			if ((r = thread_create(worker, NULL)) < 0)
+				panic("thread_create: %e", r);
+		for (i = 0; i < NTHR; i++)
+			sem_wait(&done, 0);
+		if (counter != NTHR * ROUNDS * WORK)
+			panic("counter %u, expected %u", counter,
+			      NTHR * ROUNDS * WORK);
+		cprintf("%s: %u cycles per acquisition\n",
+			use_mutex ? "futex mutex" : "spin and yield",
+			(uint32_t) (read_tsc() - start) / (NTHR * ROUNDS));
+	}
+}
@@ -0,0 +1,72 @@
+// Time IPC between two address spaces: round trips of register-only
+// messages with ipc_call, then one-way sends of a shared page.
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define ROUNDS	10000
+#define NPAGES	10000
+
+#define SENDVA	((char *) 0xa00000)
+#define RECVVA	((char *) 0xb00000)
+
+static void
+server(void)
+{
+	envid_t who;
+	uint32_t v;
+	int i, perm;
+
+	// Answer each call with value + 1 and wait for the next.  The
+	// last answer waits for the first page.
+	v = ipc_recv(&who, NULL, NULL);
+	for (i = 1; i < ROUNDS; i++)
+		v = ipc_call(who, v + 1, NULL, 0, NULL, NULL);
+	v = ipc_call(who, v + 1, RECVVA, 0, NULL, &perm);
+
+	for (i = 0; i < NPAGES; i++) {
+		if (i > 0)
+			v = ipc_recv(NULL, RECVVA, &perm);
+		if (!(perm & PTE_P) || v != i || *(uint32_t *) RECVVA != i)
+			panic("page %d: value %d, perm %x, contents %d",
+			      i, v, perm, *(uint32_t *) RECVVA);
+	}
+}
+
+void
+umain(int argc, char **argv)
+{
+	uint64_t start, t0, us;
+	envid_t who;
+	uint32_t v;
+	int i, r;
+
+	if ((who = fork()) < 0)
+		panic("fork: %e", who);
+	if (who == 0) {
+		server();
+		return;
+	}
+
+	start = read_tsc();
+	for (i = 0, v = 0; i < ROUNDS; i++)
+		if ((v = ipc_call(who, v, NULL, 0, NULL, NULL)) != i + 1)
+			panic("round trip %d: got %d", i, v);
+	cprintf("ipc_call: %u cycles per round trip\n",
+		(uint32_t) (read_tsc() - start) / ROUNDS);
+
+	// The receiver maps the same physical page each time; the value
+	// written into it shows up there without a copy.
+	if ((r = sys_page_alloc(0, SENDVA, PTE_P | PTE_U | PTE_W)) < 0)
+		panic("sys_page_alloc: %e", r);
+	t0 = gettime();
+	start = read_tsc();
+	for (i = 0; i < NPAGES; i++) {
+		*(uint32_t *) SENDVA = i;
+		ipc_send(who, i, SENDVA, PTE_P | PTE_U | PTE_W);
+	}
+	us = gettime() - t0;
+	cprintf("ipc_send: %u cycles per page, %u pages/s\n",
+		(uint32_t) (read_tsc() - start) / NPAGES,
+		(uint32_t) (us ? NPAGES * 1000000ULL / us : 0));
+}
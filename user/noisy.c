@@ -0,0 +1,70 @@
+// Noisy neighbor: one spinning thread in a "quiet" resource group
+// against four in a "noisy" group of equal weight, which also
+// allocates pages past its limit.  With proportional sharing the
+// quiet thread should get about as much CPU as all four noisy ones
+// together.  Run 'rgroups' in the monitor afterwards for the kernel's
+// view.
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define NNOISY		4
+#define WEIGHT		16
+#define PAGE_LIMIT	64
+#define DURATION	2000000000ULL	// cycles
+#define NOISY_VA	0x10000000
+
+volatile uint32_t counts[1 + NNOISY];
+volatile uint32_t denied, ndone;
+volatile int stop;
+
+static void
+spin(void *arg)
+{
+	uint32_t t = (uint32_t) arg, i;
+	int r;
+
+	// The noisy threads grab as much memory as they can first.
+	if (t > 0)
+		for (i = 0; i < 2 * PAGE_LIMIT; i++)
+			if ((r = sys_page_alloc(0, (void *) (NOISY_VA
+					+ (t * 2 * PAGE_LIMIT + i) * PGSIZE),
+					PTE_P | PTE_U | PTE_W)) < 0)
+				__sync_fetch_and_add(&denied, 1);
+
+	while (!stop)
+		counts[t]++;
+	__sync_fetch_and_add(&ndone, 1);
+}
+
+void
+umain(int argc, char **argv)
+{
+	int quiet, noisy, t;
+	uint32_t sum = 0;
+	uint64_t start;
+	envid_t id;
+
+	if ((quiet = sys_rgroup_create(WEIGHT, 0, 0)) < 0
+	    || (noisy = sys_rgroup_create(WEIGHT, PAGE_LIMIT, 0)) < 0)
+		panic("sys_rgroup_create: %e", quiet < 0 ? quiet : noisy);
+
+	for (t = 0; t <= NNOISY; t++) {
+		if ((id = thread_create(spin, (void *) t)) < 0)
+			panic("thread_create: %e", id);
+		sys_env_set_rgroup(id, t == 0 ? quiet : noisy);
+	}
+
+	start = read_tsc();
+	while (read_tsc() - start < DURATION)
+		sys_yield();
+	stop = 1;
+	while (ndone < 1 + NNOISY)
+		sys_yield();
+
+	for (t = 1; t <= NNOISY; t++)
+		sum += counts[t];
+	cprintf("quiet group: %u iterations on 1 thread\n", counts[0]);
+	cprintf("noisy group: %u iterations on %d threads, "
+		"%u page allocations denied\n", sum, NNOISY, denied);
+}
@@ -0,0 +1,7 @@
+// Do nothing and exit; used to measure the cost of spawning.
+#include <inc/lib.h>
+
+void
+umain(int argc, char **argv)
+{
+}
@@ -0,0 +1,28 @@
+// Time a null system call (sys_getenvid) entering the kernel
+// with int $T_SYSCALL and with sysenter.
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define ROUNDS	10000
+
+void
+umain(int argc, char **argv)
+{
+	bool fast = syscall_sysenter;
+	uint64_t start;
+	int i, pass;
+
+	for (pass = 0; pass <= fast; pass++) {
+		syscall_sysenter = pass;
+		start = read_tsc();
+		for (i = 0; i < ROUNDS; i++)
+			sys_getenvid();
+		cprintf("%s: %u cycles per call\n",
+			pass ? "sysenter" : "int",
+			(uint32_t) (read_tsc() - start) / ROUNDS);
+	}
+	if (!fast)
+		cprintf("sysenter: not supported\n");
+	syscall_sysenter = fast;
+}
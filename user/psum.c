@@ -0,0 +1,59 @@
+// Sum an array with 1, 2 and 4 threads and time each run.
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define NELEM	(256 * 1024)
+#define REPS	8
+#define MAXTHREADS	4
+
+uint32_t data[NELEM];
+uint32_t partial[MAXTHREADS];
+volatile uint32_t ndone;
+int nthreads;
+
+static void
+sum(void *arg)
+{
+	uint32_t i, t = (uint32_t) arg, s = 0;
+	uint32_t lo = t * (NELEM / nthreads), hi = lo + NELEM / nthreads;
+	int rep;
+
+	for (rep = 0; rep < REPS; rep++)
+		for (i = lo; i < hi; i++)
+			s += data[i];
+	partial[t] = s;
+	__sync_fetch_and_add(&ndone, 1);
+}
+
+void
+umain(int argc, char **argv)
+{
+	uint64_t start;
+	uint32_t i, total, expect = 0;
+	envid_t r;
+
+	for (i = 0; i < NELEM; i++) {
+		data[i] = i;
+		expect += i * REPS;
+	}
+
+	for (nthreads = 1; nthreads <= MAXTHREADS; nthreads *= 2) {
+		ndone = 0;
+		start = read_tsc();
+		for (i = 0; i < nthreads; i++)
+			if ((r = thread_create(sum, (void *) i)) < 0)
+				panic("thread_create: %e", r);
+		while (ndone < nthreads)
+			sys_yield();
+
+		total = 0;
+		for (i = 0; i < nthreads; i++)
+			total += partial[i];
+		if (total != expect)
+			panic("%d threads: sum %u, expected %u",
+			      nthreads, total, expect);
+		cprintf("[%08x] %d threads: %u cycles\n", thisenv->env_id,
+			nthreads, (uint32_t) (read_tsc() - start));
+	}
+}
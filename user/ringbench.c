@@ -0,0 +1,89 @@
+// Compare one trap per system call with batches queued on a system
+// call ring, for null calls (empty sys_cputs) and page alloc/unmap
+// pairs, and time how long a polled ring takes to drain on its own.
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define ROUNDS	4096
+#define BATCH	32		// Calls per ring_submit(); <= URING_NENTRY
+#define RINGVA	((void *) 0xD0000000)
+#define PAGEVA	((char *) 0xD0001000)
+
+static void
+reap(int n)
+{
+	struct URingCqe cqe;
+
+	while (n > 0)
+		if (ring_reap(&cqe)) {
+			if (cqe.cqe_res < 0)
+				panic("ring call %u: %e", cqe.cqe_tag,
+				      cqe.cqe_res);
+			n--;
+		}
+}
+
+static void
+report(const char *what, uint64_t start, int calls)
+{
+	cprintf("%-24s %6u cycles per call\n", what,
+		(uint32_t) (read_tsc() - start) / calls);
+}
+
+void
+umain(int argc, char **argv)
+{
+	uint64_t start;
+	int i, j, r;
+
+	if ((r = ring_init(RINGVA, 0)) < 0)
+		panic("ring_init: %e", r);
+
+	start = read_tsc();
+	for (i = 0; i < ROUNDS; i++)
+		sys_cputs("", 0);
+	report("null, trap per call", start, ROUNDS);
+
+	start = read_tsc();
+	for (i = 0; i < ROUNDS; i += BATCH) {
+		for (j = 0; j < BATCH; j++)
+			ring_queue(i + j, SYS_cputs, (uint32_t) "", 0, 0, 0, 0);
+		ring_submit();
+		reap(BATCH);
+	}
+	report("null, ring", start, ROUNDS);
+
+	start = read_tsc();
+	for (i = 0; i < ROUNDS; i += BATCH / 2)
+		for (j = 0; j < BATCH / 2; j++) {
+			sys_page_alloc(0, PAGEVA + j * PGSIZE,
+				       PTE_P | PTE_U | PTE_W);
+			sys_page_unmap(0, PAGEVA + j * PGSIZE);
+		}
+	report("page, trap per call", start, 2 * ROUNDS);
+
+	start = read_tsc();
+	for (i = 0; i < ROUNDS; i += BATCH / 2) {
+		for (j = 0; j < BATCH / 2; j++) {
+			ring_queue(2 * j, SYS_page_alloc, 0,
+				   (uint32_t) PAGEVA + j * PGSIZE,
+				   PTE_P | PTE_U | PTE_W, 0, 0);
+			ring_queue(2 * j + 1, SYS_page_unmap, 0,
+				   (uint32_t) PAGEVA + j * PGSIZE, 0, 0, 0);
+		}
+		ring_submit();
+		reap(BATCH);
+	}
+	report("page, ring", start, 2 * ROUNDS);
+
+	// With URING_POLL the calls run at the next kernel entry, such
+	// as a timer interrupt, without a trap of our own.
+	((struct URing *) RINGVA)->ur_flags = URING_POLL;
+	start = read_tsc();
+	for (j = 0; j < BATCH; j++)
+		ring_queue(j, SYS_cputs, (uint32_t) "", 0, 0, 0, 0);
+	reap(BATCH);
+	cprintf("polled ring drained %d calls after %u cycles\n", BATCH,
+		(uint32_t) (read_tsc() - start));
+}
@@ -0,0 +1,74 @@
+// Mixed load: a periodic thread next to four threads that never
+// yield.  The periodic thread first releases its own jobs in the
+// normal class, then runs the same jobs in the real-time class, and
+// counts the deadlines it missed each way.  'rt' in the monitor shows
+// the kernel's counts.
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define NBATCH		4
+#define NJOBS		20
+#define PERIOD		50000000	// cycles
+#define DEADLINE	PERIOD
+#define RUNTIME		20000000
+#define WORK		5000000
+
+volatile int stop;
+
+static void
+work(void)
+{
+	uint64_t start = read_tsc();
+
+	while (read_tsc() - start < WORK)
+		/* do nothing */;
+}
+
+static void
+periodic(void *arg)
+{
+	uint64_t t0, release;
+	int k, misses = 0, r;
+
+	t0 = read_tsc();
+	for (k = 0; k < NJOBS; k++) {
+		release = t0 + (uint64_t) k * PERIOD;
+		while (read_tsc() < release)
+			sys_yield();
+		work();
+		if (read_tsc() > release + DEADLINE)
+			misses++;
+	}
+	cprintf("normal class: %d of %d deadlines missed\n", misses, NJOBS);
+
+	if ((r = sys_env_set_rt(0, RUNTIME, PERIOD, DEADLINE)) < 0)
+		panic("sys_env_set_rt: %e", r);
+	for (k = 0; k < NJOBS; k++) {
+		work();
+		if ((r = sys_rt_wait()) < 0)
+			panic("sys_rt_wait: %e", r);
+	}
+	cprintf("real-time class: %d of %d deadlines missed\n", r, NJOBS);
+	sys_env_set_rt(0, 0, 0, 0);
+	stop = 1;
+}
+
+static void
+batch(void *arg)
+{
+	while (!stop)
+		/* do nothing */;
+}
+
+void
+umain(int argc, char **argv)
+{
+	int i;
+
+	for (i = 0; i < NBATCH; i++)
+		thread_create(batch, NULL);
+	thread_create(periodic, NULL);
+	while (!stop)
+		sys_yield();
+}
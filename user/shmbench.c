@@ -0,0 +1,115 @@
+// Time attaching and detaching a named shared-memory segment, then
+// share one segment as a cache among this env and NCHILD children and
+// report the memory it takes against private copies.
+
+#include <inc/lib.h>
+
+#define CACHEVA	((void *) 0xa00000)
+#define ATTVA	((void *) 0xc00000)
+#define NPAGES	64
+#define NCHILD	10
+#define NITER	1000
+#define PERM	(PTE_P | PTE_U | PTE_W)
+
+static const struct PageInfo *pageinfo = (const struct PageInfo *) UPAGES;
+
+// The sum of the physical addresses of the NPAGES pages mapped at va,
+// which only matches another env's if the same pages are mapped.
+static uint32_t
+pasum(void *va)
+{
+	uint32_t i, sum = 0;
+
+	for (i = 0; i < NPAGES; i++)
+		sum += PTE_ADDR(uvpt[PGNUM(va + i * PGSIZE)]);
+	return sum;
+}
+
+static void
+child(envid_t parent)
+{
+	uint32_t *w = ATTVA;
+	uint32_t i;
+	int h, r;
+
+	if ((h = sys_shm_lookup("cache")) < 0)
+		panic("shm_lookup: %e", h);
+	if ((r = sys_shm_attach(h, ATTVA, PTE_P | PTE_U)) < 0)
+		panic("shm_attach: %e", r);
+	for (i = 0; i < NPAGES * PGSIZE / 4; i += PGSIZE / 4)
+		if (w[i] != i)
+			panic("cache word %u is %u", i, w[i]);
+	ipc_send(parent, pasum(ATTVA), NULL, 0);
+
+	// Hold on until the parent has measured.
+	ipc_recv(NULL, NULL, NULL);
+	if ((r = sys_shm_detach(h, ATTVA)) < 0)
+		panic("shm_detach: %e", r);
+	ipc_send(parent, 0, NULL, 0);
+}
+
+void
+umain(int argc, char **argv)
+{
+	envid_t kids[NCHILD];
+	uint64_t t0, tattach = 0, tdetach = 0;
+	uint32_t *w = CACHEVA;
+	uint32_t i, sum, ref;
+	int h, r;
+
+	// Attach latency, on a segment nothing else maps
+	if ((h = sys_shm_create("bench", NPAGES, CACHEVA, PERM)) < 0)
+		panic("shm_create: %e", h);
+	for (i = 0; i < NITER; i++) {
+		t0 = gettime();
+		if ((r = sys_shm_attach(h, ATTVA, PERM)) < 0)
+			panic("shm_attach: %e", r);
+		tattach += gettime() - t0;
+		t0 = gettime();
+		if ((r = sys_shm_detach(h, ATTVA)) < 0)
+			panic("shm_detach: %e", r);
+		tdetach += gettime() - t0;
+	}
+	if ((r = sys_shm_detach(h, CACHEVA)) < 0)
+		panic("shm_detach: %e", r);
+	if ((r = sys_shm_lookup("bench")) != -E_NOT_FOUND)
+		panic("segment outlived its last detach: %e", r);
+	cprintf("%u-page attach: %u ns, detach: %u ns\n", NPAGES,
+		(uint32_t) (tattach * 1000 / NITER),
+		(uint32_t) (tdetach * 1000 / NITER));
+
+	// A cache shared by name among NCHILD + 1 envs
+	if ((h = sys_shm_create("cache", NPAGES, CACHEVA, PERM)) < 0)
+		panic("shm_create: %e", h);
+	for (i = 0; i < NPAGES * PGSIZE / 4; i += PGSIZE / 4)
+		w[i] = i;
+	sum = pasum(CACHEVA);
+	for (i = 0; i < NCHILD; i++) {
+		if ((kids[i] = fork()) < 0)
+			panic("fork: %e", kids[i]);
+		if (kids[i] == 0) {
+			child(thisenv->env_parent_id);
+			return;
+		}
+	}
+	for (i = 0; i < NCHILD; i++)
+		if (ipc_recv(NULL, NULL, NULL) != sum)
+			panic("a child mapped other pages");
+
+	// The segment's own reference, the mapping here and each child's.
+	ref = pageinfo[PGNUM(PTE_ADDR(uvpt[PGNUM(CACHEVA)]))].pp_ref;
+	cprintf("%u envs share %u pages (%u KB), each mapped %u times; "
+		"private copies would take %u KB\n",
+		NCHILD + 1, NPAGES, NPAGES * PGSIZE / 1024, ref - 1,
+		(NCHILD + 1) * NPAGES * PGSIZE / 1024);
+
+	for (i = 0; i < NCHILD; i++)
+		ipc_send(kids[i], 0, NULL, 0);
+	for (i = 0; i < NCHILD; i++)
+		ipc_recv(NULL, NULL, NULL);
+	if ((r = sys_shm_detach(h, CACHEVA)) < 0)
+		panic("shm_detach: %e", r);
+	if ((r = sys_shm_lookup("cache")) != -E_NOT_FOUND)
+		panic("segment outlived its last detach: %e", r);
+	cprintf("shmbench done\n");
+}
@@ -0,0 +1,46 @@
+// Spawn NSPAWN copies of user/nop, first with one sys_env_spawn call
+// per child and then with a single batched call, and time both.
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define NSPAWN	500
+
+envid_t ids[NSPAWN];
+
+// Wait until the n envs in ids[] have exited.
+static void
+wait_all(int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		while (envs[ENVX(ids[i])].env_id == ids[i]
+		       && envs[ENVX(ids[i])].env_status != ENV_FREE)
+			sys_yield();
+}
+
+void
+umain(int argc, char **argv)
+{
+	uint64_t start;
+	uint32_t single, batch;
+	int i, r;
+
+	start = read_tsc();
+	for (i = 0; i < NSPAWN; i++)
+		if ((r = sys_env_spawn("nop", 1, &ids[i])) < 1)
+			panic("sys_env_spawn: %e", r);
+	single = read_tsc() - start;
+	wait_all(NSPAWN);
+
+	start = read_tsc();
+	if ((r = sys_env_spawn("nop", NSPAWN, ids)) < NSPAWN)
+		panic("sys_env_spawn: %e", r < 0 ? r : -E_NO_MEM);
+	batch = read_tsc() - start;
+	wait_all(NSPAWN);
+
+	cprintf("[%08x] %d spawns: %u cycles each one by one, "
+		"%u cycles each batched\n", thisenv->env_id, NSPAWN,
+		single / NSPAWN, batch / NSPAWN);
+}
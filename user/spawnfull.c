@@ -0,0 +1,36 @@
+// Create children with sys_exofork until the env table or memory runs
+// out, timing every batch of spawns as envs[] grows, then destroy them.
+// The children never run.
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define BATCH	1024
+
+envid_t kids[NENV];
+
+void
+umain(int argc, char **argv)
+{
+	uint64_t start;
+	envid_t r;
+	int n = 0, i;
+
+	start = read_tsc();
+	while (n < NENV) {
+		if ((r = sys_exofork()) < 0)
+			break;
+		kids[n++] = r;
+		if (n % BATCH == 0) {
+			cprintf("[%08x] %d envs, %u cycles per spawn\n",
+				thisenv->env_id, n,
+				(uint32_t) (read_tsc() - start) / BATCH);
+			start = read_tsc();
+		}
+	}
+	cprintf("[%08x] spawned %d envs (NENV %d) before: %e\n",
+		thisenv->env_id, n, NENV, r);
+
+	for (i = 0; i < n; i++)
+		sys_env_destroy(kids[i]);
+}
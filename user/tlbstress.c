@@ -0,0 +1,72 @@
+// Stress the unmap path: repeatedly map a run of pages, touch them,
+// and unmap them again, first alone and then with NSPIN threads of
+// this env spinning on other CPUs.  The threads share the page
+// directory, so with them running every unmap has to shoot down the
+// other CPUs' TLBs.  Run with several CPUs, and run the 'tlb' monitor
+// command afterwards to see how many shootdown IPIs each unmapped page
+// cost.
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define NPAGES	64
+#define ROUNDS	50
+#define NSPIN	3
+
+volatile uint32_t nspinning, stop;
+
+// Keep this env's page directory loaded on some other CPU until told
+// to stop.
+static void
+spin(void *arg)
+{
+	__sync_fetch_and_add(&nspinning, 1);
+	while (!stop)
+		/* do nothing */;
+	__sync_fetch_and_sub(&nspinning, 1);
+}
+
+static uint32_t
+stress(void)
+{
+	uint64_t start;
+	int i, round, r;
+
+	start = read_tsc();
+	for (round = 0; round < ROUNDS; round++) {
+		for (i = 0; i < NPAGES; i++) {
+			char *va = (char *) UTEMP + i * PGSIZE;
+			if ((r = sys_page_alloc(0, va, PTE_P | PTE_U | PTE_W)) < 0)
+				panic("sys_page_alloc: %e", r);
+			*va = round;
+		}
+		for (i = 0; i < NPAGES; i++)
+			if ((r = sys_page_unmap(0, (char *) UTEMP + i * PGSIZE)) < 0)
+				panic("sys_page_unmap: %e", r);
+	}
+	return (read_tsc() - start) / (ROUNDS * NPAGES);
+}
+
+void
+umain(int argc, char **argv)
+{
+	uint32_t alone, shared;
+	envid_t r;
+	int i;
+
+	alone = stress();
+
+	for (i = 0; i < NSPIN; i++)
+		if ((r = thread_create(spin, NULL)) < 0)
+			panic("thread_create: %e", r);
+	while (nspinning < NSPIN)
+		sys_yield();
+	shared = stress();
+	stop = 1;
+	while (nspinning)
+		sys_yield();
+
+	cprintf("[%08x] unmapped %d pages twice, cycles per map+unmap: "
+		"%u alone, %u with %d threads on other CPUs\n",
+		thisenv->env_id, ROUNDS * NPAGES, alone, shared, NSPIN);
+}
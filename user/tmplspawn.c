@@ -0,0 +1,45 @@
+// Initialize a buffer, capture the env as a template, and time
+// starting children from it.  Each child checks that it sees the
+// initialized buffer, dirties a page of it, and exits.
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define NCLONES	64
+#define BUFSIZE	(16 * PGSIZE)
+
+uint8_t buf[BUFSIZE];
+
+void
+umain(int argc, char **argv)
+{
+	uint64_t start;
+	envid_t tmpl, r;
+	int i;
+
+	for (i = 0; i < BUFSIZE; i++)
+		buf[i] = i;
+
+	if ((tmpl = sys_env_snapshot()) < 0)
+		panic("sys_env_snapshot: %e", tmpl);
+	if (tmpl == 0) {
+		for (i = 0; i < BUFSIZE; i++)
+			if (buf[i] != (uint8_t) i)
+				panic("clone sees buf[%d] = %d", i, buf[i]);
+		buf[0] = 0xff;
+		return;
+	}
+
+	// The template is a copy-on-write snapshot: this write is ours.
+	buf[0] = 0xff;
+
+	start = read_tsc();
+	for (i = 0; i < NCLONES; i++)
+		if ((r = sys_env_clone(tmpl)) < 0)
+			panic("sys_env_clone: %e", r);
+	cprintf("[%08x] %d clones, %u cycles per clone\n",
+		thisenv->env_id, NCLONES,
+		(uint32_t) (read_tsc() - start) / NCLONES);
+
+	sys_env_destroy(tmpl);
+}
@@ -0,0 +1,38 @@
+// Time getting the envid with a system call and from the UVDATA page,
+// and reading the clock.
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define ROUNDS	10000
+
+void
+umain(int argc, char **argv)
+{
+	uint64_t start, t0;
+	int i;
+
+	if (getenvid() != sys_getenvid())
+		panic("getenvid %08x, sys_getenvid %08x", getenvid(),
+		      sys_getenvid());
+
+	start = read_tsc();
+	for (i = 0; i < ROUNDS; i++)
+		sys_getenvid();
+	cprintf("sys_getenvid: %u cycles per call\n",
+		(uint32_t) (read_tsc() - start) / ROUNDS);
+
+	start = read_tsc();
+	for (i = 0; i < ROUNDS; i++)
+		getenvid();
+	cprintf("getenvid:     %u cycles per call\n",
+		(uint32_t) (read_tsc() - start) / ROUNDS);
+
+	t0 = gettime();
+	start = read_tsc();
+	for (i = 0; i < ROUNDS; i++)
+		gettime();
+	cprintf("gettime:      %u cycles per call, %u us for the loop\n",
+		(uint32_t) (read_tsc() - start) / ROUNDS,
+		(uint32_t) (gettime() - t0));
+}
@@ -0,0 +1,68 @@
+// Ping-pong between two threads while three others spin, handing
+// the CPU over first with sys_yield and then with sys_yield_to, and
+// time the round trips.
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define ROUNDS	1000
+#define NBUSY	3
+
+volatile int turn, stop, handoff;
+envid_t pinger, ponger;
+
+// Wait for the other side, giving it the CPU if handing off.
+static void
+relax(envid_t other)
+{
+	if (handoff)
+		sys_yield_to(other);
+	else
+		sys_yield();
+}
+
+static void
+pong(void *arg)
+{
+	int i;
+
+	for (i = 0; i < 2 * ROUNDS; i++) {
+		while (turn != 1)
+			relax(pinger);
+		turn = 0;
+		relax(pinger);
+	}
+}
+
+static void
+busy(void *arg)
+{
+	while (!stop)
+		/* do nothing */;
+}
+
+void
+umain(int argc, char **argv)
+{
+	uint64_t start;
+	int i;
+
+	pinger = sys_getenvid();
+	if ((ponger = thread_create(pong, NULL)) < 0)
+		panic("thread_create: %e", ponger);
+	for (i = 0; i < NBUSY; i++)
+		thread_create(busy, NULL);
+
+	for (handoff = 0; handoff <= 1; handoff++) {
+		start = read_tsc();
+		for (i = 0; i < ROUNDS; i++) {
+			turn = 1;
+			while (turn != 0)
+				relax(ponger);
+		}
+		cprintf("%s: %u cycles per round trip\n",
+			handoff ? "sys_yield_to" : "sys_yield",
+			(uint32_t) (read_tsc() - start) / ROUNDS);
+	}
+	stop = 1;
+}